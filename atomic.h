@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic operations on words and pointers.
+ *
+ * Loads and stores come in plain (no ordering beyond atomicity),
+ * acquire (nothing after moves before it), and release (nothing
+ * before moves after it) flavors. The read-modify-write operations
+ * (cas, fetch_add, fetch_sub, exchange) are fully ordered. The fences
+ * order what comes before them against what comes after:
+ *
+ *    atomic_fence_acquire - earlier loads before anything later
+ *    atomic_fence_release - anything earlier before later stores
+ *    atomic_fence_seq_cst - anything earlier before anything later
+ *
+ * atomic_pause goes in the body of a loop that spins waiting for
+ * another CPU to change something, and tells the processor so.
+ *
+ * In the kernel these are built out of ll/sc and the membar_*
+ * functions. Anywhere else (that is, a host build of the kernel
+ * code) the compiler's __atomic builtins are used instead.
+ *
+ * The word operations work on unsigned; pointer fields go through the
+ * _ptr versions.
+ */
+
+#ifdef _KERNEL
+#include <membar.h>
+#endif
+
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+ATOMIC_INLINE unsigned atomic_load(const volatile unsigned *p);
+ATOMIC_INLINE unsigned atomic_load_acquire(const volatile unsigned *p);
+ATOMIC_INLINE void atomic_store(volatile unsigned *p, unsigned v);
+ATOMIC_INLINE void atomic_store_release(volatile unsigned *p, unsigned v);
+ATOMIC_INLINE bool atomic_cas(volatile unsigned *p, unsigned old, unsigned new);
+ATOMIC_INLINE unsigned atomic_fetch_add(volatile unsigned *p, unsigned v);
+ATOMIC_INLINE unsigned atomic_fetch_sub(volatile unsigned *p, unsigned v);
+ATOMIC_INLINE unsigned atomic_exchange(volatile unsigned *p, unsigned v);
+
+ATOMIC_INLINE void *atomic_load_ptr(void *const volatile *p);
+ATOMIC_INLINE void *atomic_load_ptr_acquire(void *const volatile *p);
+ATOMIC_INLINE void atomic_store_ptr_release(void *volatile *p, void *v);
+ATOMIC_INLINE bool atomic_cas_ptr(void *volatile *p, void *old, void *new);
+
+ATOMIC_INLINE void atomic_fence_acquire(void);
+ATOMIC_INLINE void atomic_fence_release(void);
+ATOMIC_INLINE void atomic_fence_seq_cst(void);
+
+ATOMIC_INLINE void atomic_pause(void);
+
+
+#ifdef _KERNEL
+
+/*
+ * MIPS. Aligned word loads and stores are atomic by themselves, so
+ * only the ordering needs help. Pointers are words too.
+ */
+
+ATOMIC_INLINE
+void
+atomic_fence_acquire(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+atomic_fence_release(void)
+{
+	membar_any_store();
+}
+
+ATOMIC_INLINE
+void
+atomic_fence_seq_cst(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+atomic_pause(void)
+{
+	/* Nothing to say it with on MIPS; just go around again. */
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_load(const volatile unsigned *p)
+{
+	return *p;
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_load_acquire(const volatile unsigned *p)
+{
+	unsigned v;
+
+	v = *p;
+	atomic_fence_acquire();
+	return v;
+}
+
+ATOMIC_INLINE
+void
+atomic_store(volatile unsigned *p, unsigned v)
+{
+	*p = v;
+}
+
+ATOMIC_INLINE
+void
+atomic_store_release(volatile unsigned *p, unsigned v)
+{
+	atomic_fence_release();
+	*p = v;
+}
+
+ATOMIC_INLINE
+bool
+atomic_cas(volatile unsigned *p, unsigned old, unsigned new)
+{
+	unsigned x, y;
+
+	/*
+	 * Load the current value into X with LL; if it isn't OLD we're
+	 * done. Otherwise try to store NEW with SC, which leaves 1 in Y
+	 * if the store went through and 0 if something else got there
+	 * first, in which case go around again. The instructions after
+	 * the branches are in their delay slots and harmless either way.
+	 */
+	atomic_fence_seq_cst();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"bne %0, %3, 2f;"	/*   if (x != old) fail */
+		" move %1, %4;"		/*   y = new */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   if (!y) try again */
+		" nop;"
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (old), "r" (new)
+		: "memory");
+	atomic_fence_seq_cst();
+	return x == old;
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_fetch_add(volatile unsigned *p, unsigned v)
+{
+	unsigned x, y;
+
+	atomic_fence_seq_cst();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"addu %1, %0, %3;"	/*   y = x + v */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   if (!y) try again */
+		" nop;"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (v)
+		: "memory");
+	atomic_fence_seq_cst();
+	return x;
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_exchange(volatile unsigned *p, unsigned v)
+{
+	unsigned x, y;
+
+	atomic_fence_seq_cst();
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		".set noreorder;"	/* we fill the delay slots */
+		"1: ll %0, 0(%2);"	/*   x = *p */
+		"move %1, %3;"		/*   y = v */
+		"sc %1, 0(%2);"		/*   *p = y; y = success? */
+		"beqz %1, 1b;"		/*   if (!y) try again */
+		" nop;"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y)
+		: "r" (p), "r" (v)
+		: "memory");
+	atomic_fence_seq_cst();
+	return x;
+}
+
+ATOMIC_INLINE
+void *
+atomic_load_ptr(void *const volatile *p)
+{
+	return *p;
+}
+
+ATOMIC_INLINE
+void *
+atomic_load_ptr_acquire(void *const volatile *p)
+{
+	void *v;
+
+	v = *p;
+	atomic_fence_acquire();
+	return v;
+}
+
+ATOMIC_INLINE
+void
+atomic_store_ptr_release(void *volatile *p, void *v)
+{
+	atomic_fence_release();
+	*p = v;
+}
+
+ATOMIC_INLINE
+bool
+atomic_cas_ptr(void *volatile *p, void *old, void *new)
+{
+	return atomic_cas((volatile unsigned *)p,
+			  (unsigned)(uintptr_t)old, (unsigned)(uintptr_t)new);
+}
+
+#else /* not _KERNEL */
+
+/*
+ * Host build: let the compiler do it.
+ *
+ * A host build may also define ATOMIC_HOOK to the name of a function
+ * to call before every operation; the deterministic scheduler in
+ * host/shim.c uses that as a point at which to switch threads.
+ *
+ * atomic_pause calls host_spin_pause, in host/shim.c, which now and
+ * then gives the processor up: unlike a kernel CPU at splhigh, the
+ * host thread being waited for may have been preempted.
+ */
+
+void host_spin_pause(void);
+
+#ifdef ATOMIC_HOOK
+void ATOMIC_HOOK(void);
+#define ATOMIC_POINT() ATOMIC_HOOK()
+#else
+#define ATOMIC_POINT() ((void)0)
+#endif
+
+ATOMIC_INLINE
+void
+atomic_fence_acquire(void)
+{
+	ATOMIC_POINT();
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+ATOMIC_INLINE
+void
+atomic_fence_release(void)
+{
+	ATOMIC_POINT();
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+ATOMIC_INLINE
+void
+atomic_fence_seq_cst(void)
+{
+	ATOMIC_POINT();
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+ATOMIC_INLINE
+void
+atomic_pause(void)
+{
+	host_spin_pause();
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_load(const volatile unsigned *p)
+{
+	ATOMIC_POINT();
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_load_acquire(const volatile unsigned *p)
+{
+	ATOMIC_POINT();
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+ATOMIC_INLINE
+void
+atomic_store(volatile unsigned *p, unsigned v)
+{
+	ATOMIC_POINT();
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+ATOMIC_INLINE
+void
+atomic_store_release(volatile unsigned *p, unsigned v)
+{
+	ATOMIC_POINT();
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+ATOMIC_INLINE
+bool
+atomic_cas(volatile unsigned *p, unsigned old, unsigned new)
+{
+	ATOMIC_POINT();
+	return __atomic_compare_exchange_n(p, &old, new, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_fetch_add(volatile unsigned *p, unsigned v)
+{
+	ATOMIC_POINT();
+	return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+}
+
+ATOMIC_INLINE
+unsigned
+atomic_exchange(volatile unsigned *p, unsigned v)
+{
+	ATOMIC_POINT();
+	return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+ATOMIC_INLINE
+void *
+atomic_load_ptr(void *const volatile *p)
+{
+	ATOMIC_POINT();
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+ATOMIC_INLINE
+void *
+atomic_load_ptr_acquire(void *const volatile *p)
+{
+	ATOMIC_POINT();
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+ATOMIC_INLINE
+void
+atomic_store_ptr_release(void *volatile *p, void *v)
+{
+	ATOMIC_POINT();
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+ATOMIC_INLINE
+bool
+atomic_cas_ptr(void *volatile *p, void *old, void *new)
+{
+	ATOMIC_POINT();
+	return __atomic_compare_exchange_n(p, &old, new, false,
+					   __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif /* _KERNEL */
+
+/*
+ * Same on both.
+ */
+
+ATOMIC_INLINE
+unsigned
+atomic_fetch_sub(volatile unsigned *p, unsigned v)
+{
+	return atomic_fetch_add(p, -v);
+}
+
+#endif /* _ATOMIC_H_ */
@@ -0,0 +1,17 @@
+/*
+ * Host build: run a kernel menu test as a program. HOST_TEST names the
+ * test's function, and is set by the Makefile; the test gets the
+ * command line as its arguments, just as from the kernel menu.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <test.h>
+#include <host.h>
+
+int
+main(int argc, char **argv)
+{
+	host_bootstrap();
+	return HOST_TEST(argc, argv);
+}
@@ -0,0 +1,15 @@
+/*
+ * Host build: <clock.h>.
+ */
+
+#ifndef _CLOCK_H_
+#define _CLOCK_H_
+
+#include <types.h>
+
+void gettime(struct timespec *ts);
+void timespec_sub(const struct timespec *ts1, const struct timespec *ts2,
+		  struct timespec *ret);
+void clocksleep(int seconds);
+
+#endif /* _CLOCK_H_ */
@@ -0,0 +1,26 @@
+/*
+ * Host build: <cpu.h>.
+ *
+ * Every thread runs on a CPU of its own, since a pthread can't turn
+ * off preemption the way a kernel thread turns off interrupts: code
+ * that relies on staying on one CPU while at splhigh stays correct
+ * that way. CPU numbers are handed out as threads start, so at most
+ * HOST_MAXCPUS threads can exist at once.
+ */
+
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#include <spinlock.h>
+
+#define HOST_MAXCPUS 32
+
+struct cpu {
+	struct cpu *c_self;
+	unsigned c_number;
+	struct thread *c_curthread;
+	unsigned c_spinlocks;		/* spinlocks held */
+	HANGMAN_ACTOR(c_hangman);
+};
+
+#endif /* _CPU_H_ */
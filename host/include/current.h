@@ -0,0 +1,16 @@
+/*
+ * Host build: <current.h>.
+ */
+
+#ifndef _CURRENT_H_
+#define _CURRENT_H_
+
+#include <cpu.h>
+
+extern __thread struct cpu *host_curcpu;
+
+#define curcpu host_curcpu
+#define curthread (host_curcpu->c_curthread)
+#define CURCPU_EXISTS() (host_curcpu != NULL)
+
+#endif /* _CURRENT_H_ */
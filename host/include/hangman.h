@@ -0,0 +1,21 @@
+/*
+ * Host build: <hangman.h>.
+ *
+ * The deadlock detector is compiled out, as in a kernel built
+ * without the hangman option.
+ */
+
+#ifndef _HANGMAN_H_
+#define _HANGMAN_H_
+
+#define HANGMAN_ACTOR(sym)
+#define HANGMAN_LOCKABLE(sym)
+
+#define HANGMAN_ACTORINIT(a, n)
+#define HANGMAN_LOCKABLEINIT(a, n)
+
+#define HANGMAN_WAIT(a, l)
+#define HANGMAN_ACQUIRE(a, l)
+#define HANGMAN_RELEASE(a, l)
+
+#endif /* _HANGMAN_H_ */
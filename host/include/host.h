@@ -0,0 +1,29 @@
+/*
+ * Host build: things a host program needs that the kernel gets from
+ * boot() instead.
+ *
+ *    host_bootstrap - Make the calling (main) thread a kernel thread on
+ *                     CPU 0 and call synch_bootstrap. Call first.
+ *    host_join      - Wait for every thread started with thread_fork to
+ *                     exit.
+ *    host_ncpus     - Number of host processors online.
+ *    host_sim_point - A scheduling point for the deterministic
+ *                     scheduler (see shim.c); does nothing unless
+ *                     HOST_SIM_SEED is set. Code built with
+ *                     ATOMIC_HOOK=host_sim_point calls it before every
+ *                     atomic operation.
+ *    host_spin_pause - One lap of a spin loop (atomic_pause): yields
+ *                     now and then, since what the loop waits for may
+ *                     be up to a thread that has been preempted.
+ */
+
+#ifndef _HOST_H_
+#define _HOST_H_
+
+void host_bootstrap(void);
+void host_join(void);
+unsigned host_ncpus(void);
+void host_sim_point(void);
+void host_spin_pause(void);
+
+#endif /* _HOST_H_ */
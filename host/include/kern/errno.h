@@ -0,0 +1,10 @@
+/*
+ * Host build: <kern/errno.h>.
+ */
+
+#ifndef _KERN_ERRNO_H_
+#define _KERN_ERRNO_H_
+
+#include <errno.h>
+
+#endif /* _KERN_ERRNO_H_ */
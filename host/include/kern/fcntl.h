@@ -0,0 +1,21 @@
+/*
+ * Host build: <kern/fcntl.h>.
+ *
+ * The kernel's open flags, with the kernel's values; vfs_open
+ * translates them.
+ */
+
+#ifndef _KERN_FCNTL_H_
+#define _KERN_FCNTL_H_
+
+#define O_RDONLY	0
+#define O_WRONLY	1
+#define O_RDWR		2
+#define O_ACCMODE	3
+
+#define O_CREAT		4
+#define O_EXCL		8
+#define O_TRUNC		16
+#define O_APPEND	32
+
+#endif /* _KERN_FCNTL_H_ */
@@ -0,0 +1,33 @@
+/*
+ * Host build: <lib.h>.
+ *
+ * The parts of the kernel library the sync code uses. KASSERT is
+ * always on, as in a debug kernel.
+ */
+
+#ifndef _LIB_H_
+#define _LIB_H_
+
+#include <types.h>
+#include <stdio.h>		/* snprintf */
+#include <stdlib.h>
+#include <string.h>
+
+void *kmalloc(size_t size);
+void kfree(void *ptr);
+char *kstrdup(const char *str);
+
+int kprintf(const char *fmt, ...) __attribute__((__format__(__printf__, 1, 2)));
+void panic(const char *fmt, ...)
+	__attribute__((__noreturn__, __format__(__printf__, 1, 2)));
+
+void badassert(const char *expr, const char *file, int line, const char *func)
+	__attribute__((__noreturn__));
+
+#define KASSERT(expr) \
+	((expr) ? (void)0 : badassert(#expr, __FILE__, __LINE__, __func__))
+
+#define DIVROUNDUP(a, b) (((a) + (b) - 1) / (b))
+#define ROUNDUP(a, b) (DIVROUNDUP(a, b) * (b))
+
+#endif /* _LIB_H_ */
@@ -0,0 +1,14 @@
+/*
+ * Host build: <membar.h>.
+ */
+
+#ifndef _MEMBAR_H_
+#define _MEMBAR_H_
+
+#define membar_any_any()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define membar_load_load()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define membar_store_store()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define membar_store_any()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define membar_any_store()	__atomic_thread_fence(__ATOMIC_RELEASE)
+
+#endif /* _MEMBAR_H_ */
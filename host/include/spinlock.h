@@ -0,0 +1,32 @@
+/*
+ * Host build: <spinlock.h>.
+ *
+ * Same interface as the kernel's. The lock word is set with a
+ * test-and-set; waiters spin briefly and then yield the processor,
+ * since unlike a kernel CPU a host thread can be preempted while it
+ * holds the lock.
+ */
+
+#ifndef _SPINLOCK_H_
+#define _SPINLOCK_H_
+
+#include <hangman.h>
+
+struct cpu;
+
+struct spinlock {
+	volatile unsigned splk_lock;
+	struct cpu *splk_holder;
+};
+
+#define SPINLOCK_INITIALIZER { 0, NULL }
+
+void spinlock_init(struct spinlock *lk);
+void spinlock_cleanup(struct spinlock *lk);
+
+void spinlock_acquire(struct spinlock *lk);
+void spinlock_release(struct spinlock *lk);
+
+bool spinlock_do_i_hold(struct spinlock *lk);
+
+#endif /* _SPINLOCK_H_ */
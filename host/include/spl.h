@@ -0,0 +1,21 @@
+/*
+ * Host build: <spl.h>.
+ *
+ * There are no interrupts, and each thread has its own CPU, so these
+ * only keep track of the level.
+ */
+
+#ifndef _SPL_H_
+#define _SPL_H_
+
+#define IPL_NONE 0
+#define IPL_HIGH 1
+
+int splhigh(void);
+int spl0(void);
+int splx(int spl);
+
+void splraise(int oldipl, int newipl);
+void spllower(int oldipl, int newipl);
+
+#endif /* _SPL_H_ */
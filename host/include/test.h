@@ -0,0 +1,15 @@
+/*
+ * Host build: <test.h>.
+ *
+ * The kernel menu tests that are built into the host programs. They
+ * take the menu's arguments, ARGS[0] being the command name.
+ */
+
+#ifndef _TEST_H_
+#define _TEST_H_
+
+int synchbench(int nargs, char **args);
+int synchwork(int nargs, char **args);
+int rcutest(int nargs, char **args);
+
+#endif /* _TEST_H_ */
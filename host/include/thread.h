@@ -0,0 +1,29 @@
+/*
+ * Host build: <thread.h>.
+ *
+ * Each kernel thread is a pthread. Only the fields the sync code
+ * looks at are here.
+ */
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+#include <spinlock.h>
+
+struct cpu;
+struct proc;
+
+struct thread {
+	char *t_name;
+	struct cpu *t_cpu;
+	bool t_in_interrupt;		/* always false on the host */
+	HANGMAN_ACTOR(t_hangman);
+};
+
+int thread_fork(const char *name, struct proc *proc,
+		void (*func)(void *, unsigned long),
+		void *data1, unsigned long data2);
+void thread_yield(void);
+__attribute__((__noreturn__)) void thread_exit(void);
+
+#endif /* _THREAD_H_ */
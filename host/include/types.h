@@ -0,0 +1,19 @@
+/*
+ * Host build: <types.h>.
+ *
+ * The kernel's basic types, taken from the C library.
+ */
+
+#ifndef _TYPES_H_
+#define _TYPES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* As in the kernel's <cdefs.h>: one out-of-line copy, made on request. */
+#define INLINE extern inline __attribute__((__gnu_inline__))
+
+#endif /* _TYPES_H_ */
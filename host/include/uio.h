@@ -0,0 +1,41 @@
+/*
+ * Host build: <uio.h>.
+ *
+ * Kernel-space transfers only.
+ */
+
+#ifndef _UIO_H_
+#define _UIO_H_
+
+#include <types.h>
+
+struct iovec {
+	void *iov_kbase;
+	size_t iov_len;
+};
+
+enum uio_rw {
+	UIO_READ,
+	UIO_WRITE,
+};
+
+enum uio_seg {
+	UIO_USERISPACE,
+	UIO_USERSPACE,
+	UIO_SYSSPACE,
+};
+
+struct uio {
+	struct iovec *uio_iov;
+	unsigned uio_iovcnt;
+	off_t uio_offset;
+	size_t uio_resid;
+	enum uio_seg uio_segflg;
+	enum uio_rw uio_rw;
+	struct addrspace *uio_space;
+};
+
+void uio_kinit(struct iovec *, struct uio *,
+	       void *kbuf, size_t len, off_t pos, enum uio_rw rw);
+
+#endif /* _UIO_H_ */
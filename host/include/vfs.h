@@ -0,0 +1,15 @@
+/*
+ * Host build: <vfs.h>.
+ *
+ * Paths are host paths.
+ */
+
+#ifndef _VFS_H_
+#define _VFS_H_
+
+struct vnode;
+
+int vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret);
+void vfs_close(struct vnode *vn);
+
+#endif /* _VFS_H_ */
@@ -0,0 +1,20 @@
+/*
+ * Host build: <vnode.h>.
+ *
+ * A vnode is an open host file.
+ */
+
+#ifndef _VNODE_H_
+#define _VNODE_H_
+
+struct uio;
+
+struct vnode {
+	int vn_fd;
+};
+
+int host_vop_write(struct vnode *vn, struct uio *uio);
+
+#define VOP_WRITE(vn, uio) host_vop_write(vn, uio)
+
+#endif /* _VNODE_H_ */
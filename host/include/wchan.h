@@ -0,0 +1,22 @@
+/*
+ * Host build: <wchan.h>.
+ *
+ * Same interface and rules as the kernel's: the list of sleepers is
+ * protected by the spinlock passed in, which must be held. Sleepers
+ * block in the host kernel on a futex.
+ */
+
+#ifndef _WCHAN_H_
+#define _WCHAN_H_
+
+struct spinlock;
+
+struct wchan *wchan_create(const char *name);
+void wchan_destroy(struct wchan *wc);
+
+bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
+void wchan_sleep(struct wchan *wc, struct spinlock *lk);
+void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
+void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
+
+#endif /* _WCHAN_H_ */
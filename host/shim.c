@@ -0,0 +1,1052 @@
+/*
+ * Host build: the kernel services synch.c depends on, implemented on
+ * top of pthreads and Linux futexes, so that synch.c can be compiled
+ * unchanged into a user program and run on a real multicore machine.
+ *
+ * The model is one CPU per thread (see <cpu.h>): splhigh and friends
+ * have nothing to do, a spinlock is a test-and-set word that yields
+ * when it is held for long, and a wait channel is a FIFO of sleepers,
+ * protected by the caller's spinlock just as in the kernel, each of
+ * which blocks on a futex word of its own.
+ *
+ * Threads sleeping in a wait channel or gone for good don't hold up
+ * RCU grace periods, as in the kernel's scheduler.
+ *
+ * With HOST_SIM_SEED set in the environment, the threads are run by a
+ * deterministic scheduler instead; see "deterministic scheduler" below.
+ * HOST_CLUSTERS sets up CPU clusters; see "topology".
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
+#include <clock.h>
+#include <synch.h>
+#include <host.h>
+
+/* Laps of a spin loop before yielding the processor. */
+#define SPIN_YIELD 100
+
+__thread struct cpu *host_curcpu;
+
+/*
+ * CPU numbers, handed out to threads as they start.
+ */
+static pthread_mutex_t cpus_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool cpus_used[HOST_MAXCPUS];
+
+/*
+ * Threads started with thread_fork, for host_join.
+ */
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t threads_cv = PTHREAD_COND_INITIALIZER;
+static unsigned threads_running;
+
+/*
+ * A kernel thread, and the CPU it has to itself.
+ */
+struct hthread {
+	struct thread ht_thread;	/* first, so curthread finds us */
+	struct cpu ht_cpu;
+	void (*ht_func)(void *, unsigned long);
+	void *ht_data1;
+	unsigned long ht_data2;
+	pthread_t ht_pthread;
+
+	/* For wakeup placement; see "topology". */
+	pthread_mutex_t ht_placelock;	/* protects ht_where and pinning */
+	volatile unsigned ht_where;	/* CPU it was last placed on */
+
+	/* For the deterministic scheduler, under sim_lock. */
+	pthread_cond_t ht_simcv;	/* signalled when it is our turn */
+	bool ht_runnable;
+	uint64_t ht_wakeat;		/* end of clocksleep, or 0 */
+};
+
+static bool sim_on;
+
+static void sim_point(void);
+static void topo_unplace(struct hthread *ht, volatile unsigned *woken);
+static void sim_yield(void);
+
+////////////////////////////////////////////////////////////
+// kernel library
+
+void *
+kmalloc(size_t size)
+{
+	return malloc(size);
+}
+
+void
+kfree(void *ptr)
+{
+	free(ptr);
+}
+
+char *
+kstrdup(const char *str)
+{
+	return strdup(str);
+}
+
+int
+kprintf(const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vprintf(fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+void
+panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush(stdout);
+	fprintf(stderr, "panic: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	abort();
+}
+
+void
+badassert(const char *expr, const char *file, int line, const char *func)
+{
+	panic("Assertion failed: %s, at %s:%d (%s)\n", expr, file, line, func);
+}
+
+////////////////////////////////////////////////////////////
+// futexes
+
+static
+void
+futex_wait(volatile unsigned *word, unsigned val)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static
+void
+futex_wake(volatile unsigned *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+////////////////////////////////////////////////////////////
+// deterministic scheduler
+
+/*
+ * With HOST_SIM_SEED set, host_bootstrap turns this on and only one
+ * thread runs at a time. The others wait for their turn on a condition
+ * variable of their own. The running thread passes the turn on only at
+ * scheduling points:
+ *
+ *    - every spinlock acquire and release, and every lap of a spin
+ *      loop, on a held spinlock or in atomic_pause (which always
+ *      switches; whoever is being waited for can't get on until it
+ *      runs);
+ *    - sleeping, thread_yield, thread exit and host_join;
+ *    - every atomic operation, in code built with
+ *      ATOMIC_HOOK=host_sim_point (the *-sim programs).
+ *
+ * At each point a PRNG seeded from HOST_SIM_SEED decides whether to
+ * switch, and to which runnable thread. The clock is virtual: gettime
+ * returns HOST_SIM_TICK (default SIM_TICK) ns per scheduling point so
+ * far, and clocksleep jumps ahead when nothing else can run; tests
+ * that run for a set time (synchwork) want a bigger tick. So the same
+ * seed gives the same interleaving, the same wake order and the same
+ * timings, every run. At exit the number of points and switches and a
+ * hash of the whole schedule go to stderr, so runs can be checked
+ * against each other.
+ *
+ * Heap and stack addresses have to be the same every run too, since
+ * the wait table hashes them; run with address randomization off
+ * (setarch -R).
+ */
+#define SIM_TICK	10	/* virtual ns per scheduling point */
+#define SIM_SWITCH	4	/* switch at one point in this many */
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hthread *sim_threads[HOST_MAXCPUS];	/* by CPU number */
+static struct hthread *sim_current;	/* the one that's running */
+static struct hthread *sim_joiner;	/* thread in host_join, if any */
+static unsigned long long sim_seed;
+static uint64_t sim_rng;
+static uint64_t sim_clock;		/* virtual ns */
+static uint64_t sim_tick;		/* ns per scheduling point */
+static unsigned long long sim_points, sim_switches;
+static uint64_t sim_hash = 14695981039346656037ULL;	/* FNV-1a */
+
+static
+unsigned
+sim_random(void)
+{
+	/* xorshift64* */
+	sim_rng ^= sim_rng >> 12;
+	sim_rng ^= sim_rng << 25;
+	sim_rng ^= sim_rng >> 27;
+	return (sim_rng * 2685821657736338717ULL) >> 32;
+}
+
+static
+struct hthread *
+sim_self(void)
+{
+	return host_curcpu == NULL ? NULL : (struct hthread *)curthread;
+}
+
+/*
+ * Wake the threads whose clocksleep is over.
+ */
+static
+void
+sim_timers(void)
+{
+	unsigned i;
+
+	for (i = 0; i < HOST_MAXCPUS; i++) {
+		if (sim_threads[i] != NULL && sim_threads[i]->ht_wakeat != 0 &&
+		    sim_threads[i]->ht_wakeat <= sim_clock) {
+			sim_threads[i]->ht_wakeat = 0;
+			sim_threads[i]->ht_runnable = true;
+		}
+	}
+}
+
+/*
+ * Choose the next thread to run: any runnable one, or if OTHER, any
+ * but SELF unless SELF is the only choice. If nothing can run, skip
+ * the clock ahead to the next clocksleep to end. Call with sim_lock
+ * held.
+ */
+static
+struct hthread *
+sim_pick(struct hthread *self, bool other)
+{
+	struct hthread *ready[HOST_MAXCPUS];
+	uint64_t next;
+	unsigned i, n;
+
+	for (;;) {
+		sim_timers();
+		n = 0;
+		for (i = 0; i < HOST_MAXCPUS; i++) {
+			if (sim_threads[i] != NULL &&
+			    sim_threads[i]->ht_runnable &&
+			    !(other && sim_threads[i] == self)) {
+				ready[n++] = sim_threads[i];
+			}
+		}
+		if (n > 0) {
+			return ready[sim_random() % n];
+		}
+		if (other && self != NULL && self->ht_runnable) {
+			return self;
+		}
+
+		next = 0;
+		for (i = 0; i < HOST_MAXCPUS; i++) {
+			if (sim_threads[i] != NULL &&
+			    sim_threads[i]->ht_wakeat != 0 &&
+			    (next == 0 || sim_threads[i]->ht_wakeat < next)) {
+				next = sim_threads[i]->ht_wakeat;
+			}
+		}
+		if (next == 0) {
+			panic("sim: every thread is asleep\n");
+		}
+		sim_clock = next;
+	}
+}
+
+/*
+ * Hand the turn to NEXT, then wait for it to come back to SELF (unless
+ * SELF is NULL, for a thread that is exiting). Call with sim_lock
+ * held.
+ */
+static
+void
+sim_run(struct hthread *self, struct hthread *next)
+{
+	if (next != self) {
+		sim_switches++;
+		sim_hash = (sim_hash ^ next->ht_cpu.c_number) *
+			1099511628211ULL;
+		sim_current = next;
+		pthread_cond_signal(&next->ht_simcv);
+	}
+	if (self != NULL) {
+		while (sim_current != self) {
+			pthread_cond_wait(&self->ht_simcv, &sim_lock);
+		}
+	}
+}
+
+/*
+ * Stop running until something makes SELF runnable again (and then
+ * until it is picked). Call with sim_lock held.
+ */
+static
+void
+sim_block(struct hthread *self)
+{
+	self->ht_runnable = false;
+	sim_run(self, sim_pick(self, true));
+}
+
+/*
+ * A scheduling point: maybe switch to another thread.
+ */
+static
+void
+sim_point(void)
+{
+	struct hthread *self;
+
+	if (!sim_on || (self = sim_self()) == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&sim_lock);
+	sim_points++;
+	sim_clock += sim_tick;
+	if (sim_random() % SIM_SWITCH == 0) {
+		sim_run(self, sim_pick(self, false));
+	}
+	pthread_mutex_unlock(&sim_lock);
+}
+
+/*
+ * A scheduling point where we'd rather someone else ran.
+ */
+static
+void
+sim_yield(void)
+{
+	struct hthread *self = sim_self();
+
+	pthread_mutex_lock(&sim_lock);
+	sim_points++;
+	sim_clock += sim_tick;
+	sim_run(self, sim_pick(self, true));
+	pthread_mutex_unlock(&sim_lock);
+}
+
+static
+void
+sim_report(void)
+{
+	fprintf(stderr, "sim: seed %llu, %llu points, %llu switches, "
+		"schedule %016llx, %llu ns\n", sim_seed, sim_points,
+		sim_switches, (unsigned long long)sim_hash,
+		(unsigned long long)sim_clock);
+}
+
+/*
+ * Turn the scheduler on if HOST_SIM_SEED is set. MAIN, the only thread
+ * so far, is running.
+ */
+static
+void
+sim_bootstrap(struct hthread *main)
+{
+	const char *seed, *tick;
+
+	seed = getenv("HOST_SIM_SEED");
+	if (seed == NULL) {
+		return;
+	}
+	tick = getenv("HOST_SIM_TICK");
+	sim_tick = tick != NULL ? strtoull(tick, NULL, 0) : 0;
+	if (sim_tick == 0) {
+		sim_tick = SIM_TICK;
+	}
+	sim_seed = strtoull(seed, NULL, 0);
+	sim_rng = sim_seed * 0x9e3779b97f4a7c15ULL + 1;
+	sim_on = true;
+
+	pthread_cond_init(&main->ht_simcv, NULL);
+	main->ht_runnable = true;
+	main->ht_wakeat = 0;
+	sim_threads[main->ht_cpu.c_number] = main;
+	sim_current = main;
+	atexit(sim_report);
+}
+
+void
+host_sim_point(void)
+{
+	sim_point();
+}
+
+////////////////////////////////////////////////////////////
+// spinlocks
+
+void
+spinlock_init(struct spinlock *lk)
+{
+	lk->splk_lock = 0;
+	__atomic_store_n(&lk->splk_holder, NULL, __ATOMIC_RELAXED);
+}
+
+void
+spinlock_cleanup(struct spinlock *lk)
+{
+	KASSERT(lk->splk_holder == NULL);
+	KASSERT(lk->splk_lock == 0);
+}
+
+/*
+ * One lap of a spin loop; see atomic_pause.
+ */
+void
+host_spin_pause(void)
+{
+	static __thread unsigned spins;
+
+	if (sim_on) {
+		/* Whoever we wait for isn't running until we stop. */
+		sim_yield();
+		return;
+	}
+	if (++spins == SPIN_YIELD) {
+		sched_yield();
+		spins = 0;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	else {
+		__builtin_ia32_pause();
+	}
+#endif
+}
+
+void
+spinlock_acquire(struct spinlock *lk)
+{
+	if (__atomic_load_n(&lk->splk_holder, __ATOMIC_RELAXED) == curcpu) {
+		panic("Deadlock on spinlock %p\n", lk);
+	}
+
+	sim_point();
+	while (__atomic_exchange_n(&lk->splk_lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(&lk->splk_lock, __ATOMIC_RELAXED)) {
+			host_spin_pause();
+		}
+	}
+
+	__atomic_store_n(&lk->splk_holder, curcpu, __ATOMIC_RELAXED);
+	curcpu->c_spinlocks++;
+}
+
+void
+spinlock_release(struct spinlock *lk)
+{
+	KASSERT(lk->splk_holder == curcpu);
+	KASSERT(curcpu->c_spinlocks > 0);
+
+	sim_point();
+	curcpu->c_spinlocks--;
+	__atomic_store_n(&lk->splk_holder, NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&lk->splk_lock, 0, __ATOMIC_RELEASE);
+}
+
+bool
+spinlock_do_i_hold(struct spinlock *lk)
+{
+	return lk->splk_holder == curcpu;
+}
+
+////////////////////////////////////////////////////////////
+// wait channels
+
+struct wsleeper {
+	struct wsleeper *ws_next;
+	volatile unsigned ws_woken;	/* futex word */
+	struct hthread *ws_thread;	/* for the deterministic scheduler */
+};
+
+struct wchan {
+	const char *wc_name;
+	struct wsleeper *wc_head;
+	struct wsleeper *wc_tail;
+};
+
+struct wchan *
+wchan_create(const char *name)
+{
+	struct wchan *wc;
+
+	wc = kmalloc(sizeof(*wc));
+	if (wc == NULL) {
+		return NULL;
+	}
+	wc->wc_name = name;
+	wc->wc_head = wc->wc_tail = NULL;
+	return wc;
+}
+
+void
+wchan_destroy(struct wchan *wc)
+{
+	KASSERT(wc->wc_head == NULL);
+	kfree(wc);
+}
+
+bool
+wchan_isempty(struct wchan *wc, struct spinlock *lk)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+	return wc->wc_head == NULL;
+}
+
+void
+wchan_sleep(struct wchan *wc, struct spinlock *lk)
+{
+	struct wsleeper me;
+
+	KASSERT(spinlock_do_i_hold(lk));
+	KASSERT(curcpu->c_spinlocks == 1);
+
+	me.ws_next = NULL;
+	me.ws_woken = 0;
+	me.ws_thread = sim_self();
+	if (wc->wc_tail == NULL) {
+		wc->wc_head = &me;
+	}
+	else {
+		wc->wc_tail->ws_next = &me;
+	}
+	wc->wc_tail = &me;
+
+	spinlock_release(lk);
+	topo_unplace((struct hthread *)curthread, &me.ws_woken);
+	rcu_idle_enter();
+	if (sim_on) {
+		pthread_mutex_lock(&sim_lock);
+		while (me.ws_woken == 0) {
+			sim_block(me.ws_thread);
+		}
+		pthread_mutex_unlock(&sim_lock);
+	}
+	while (__atomic_load_n(&me.ws_woken, __ATOMIC_ACQUIRE) == 0) {
+		futex_wait(&me.ws_woken, 0);
+	}
+	rcu_idle_exit();
+	spinlock_acquire(lk);
+}
+
+/*
+ * Take the first sleeper off and wake it. Once ws_woken is set the
+ * sleeper may return and its record (on its stack) go away, so the
+ * futex wake can land on a stale address. That's harmless: at worst
+ * it is a spurious wakeup for whoever waits there next, and futex
+ * waiters always recheck.
+ */
+static
+bool
+wchan_wakehead(struct wchan *wc)
+{
+	struct wsleeper *ws;
+
+	ws = wc->wc_head;
+	if (ws == NULL) {
+		return false;
+	}
+	wc->wc_head = ws->ws_next;
+	if (wc->wc_head == NULL) {
+		wc->wc_tail = NULL;
+	}
+	if (sim_on) {
+		/* It's not running, so there's no race with it. */
+		pthread_mutex_lock(&sim_lock);
+		ws->ws_woken = 1;
+		ws->ws_thread->ht_runnable = true;
+		pthread_mutex_unlock(&sim_lock);
+		return true;
+	}
+	__atomic_store_n(&ws->ws_woken, 1, __ATOMIC_RELEASE);
+	futex_wake(&ws->ws_woken);
+	return true;
+}
+
+void
+wchan_wakeone(struct wchan *wc, struct spinlock *lk)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+	wchan_wakehead(wc);
+}
+
+void
+wchan_wakeall(struct wchan *wc, struct spinlock *lk)
+{
+	KASSERT(spinlock_do_i_hold(lk));
+	while (wchan_wakehead(wc)) {
+		/* nothing */
+	}
+}
+
+////////////////////////////////////////////////////////////
+// interrupt levels
+
+int
+splhigh(void)
+{
+	return IPL_HIGH;
+}
+
+int
+spl0(void)
+{
+	return IPL_NONE;
+}
+
+int
+splx(int spl)
+{
+	return spl;
+}
+
+void
+splraise(int oldipl, int newipl)
+{
+	KASSERT(oldipl < newipl);
+}
+
+void
+spllower(int oldipl, int newipl)
+{
+	KASSERT(oldipl > newipl);
+}
+
+////////////////////////////////////////////////////////////
+// clock
+
+void
+gettime(struct timespec *ts)
+{
+	if (sim_on) {
+		sim_point();
+		pthread_mutex_lock(&sim_lock);
+		ts->tv_sec = sim_clock / 1000000000;
+		ts->tv_nsec = sim_clock % 1000000000;
+		pthread_mutex_unlock(&sim_lock);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, ts);
+}
+
+void
+timespec_sub(const struct timespec *ts1, const struct timespec *ts2,
+	     struct timespec *ret)
+{
+	ret->tv_sec = ts1->tv_sec - ts2->tv_sec;
+	ret->tv_nsec = ts1->tv_nsec - ts2->tv_nsec;
+	if (ret->tv_nsec < 0) {
+		ret->tv_nsec += 1000000000;
+		ret->tv_sec--;
+	}
+}
+
+void
+clocksleep(int seconds)
+{
+	struct timespec ts;
+	struct hthread *self;
+
+	ts.tv_sec = seconds;
+	ts.tv_nsec = 0;
+	rcu_idle_enter();
+	if (sim_on) {
+		pthread_mutex_lock(&sim_lock);
+		self = sim_self();
+		self->ht_wakeat = sim_clock + seconds * 1000000000ULL + 1;
+		while (self->ht_wakeat != 0) {
+			sim_block(self);
+		}
+		pthread_mutex_unlock(&sim_lock);
+	}
+	else {
+		nanosleep(&ts, NULL);
+	}
+	rcu_idle_exit();
+}
+
+////////////////////////////////////////////////////////////
+// topology
+
+/*
+ * With HOST_CLUSTERS=N in the environment, host CPUs are put in
+ * clusters of N by number (0 to N-1, N to 2N-1, ...) for the cohort
+ * lock, and each thread is pinned to the real processor with its CPU
+ * number, modulo the number online. Pick N to match the way the
+ * machine numbers its processors (lscpu -e), so that a cluster is a
+ * socket or a shared cache. Without it, every CPU is in cluster 0 and
+ * threads go wherever the host puts them.
+ *
+ * CPU numbers here are always the kernel ones (c_number), and CPU n
+ * means the processor it is pinned to, n modulo the number online, so
+ * the cluster table is filled in by processor and CPUs that share one
+ * share a cluster. For wakeup placement (see synch.h) a thread's CPU
+ * is its own until a wakeup places it on another: the waker pins it
+ * to that CPU's processor just after waking it, and the thread goes
+ * back to its own when it next sleeps, unless it's woken first.
+ * Neither happens with a spinlock held. Placement needs the pinning,
+ * and would change the schedule the deterministic scheduler replays,
+ * so it is only set up with HOST_CLUSTERS and without HOST_SIM_SEED.
+ */
+static unsigned topo_size;
+
+/*
+ * Pin HT to the processor of CPU CPU, and make that its CPU. If the
+ * host won't have it, say so the first time and leave HT where it is.
+ */
+static
+void
+topo_pin(struct hthread *ht, unsigned cpu)
+{
+	static bool warned;
+	cpu_set_t set;
+	int err;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu % host_ncpus(), &set);
+	err = pthread_setaffinity_np(ht->ht_pthread, sizeof(set), &set);
+	if (err) {
+		if (!__atomic_exchange_n(&warned, true, __ATOMIC_RELAXED)) {
+			fprintf(stderr, "host: pthread_setaffinity_np: %s\n",
+				strerror(err));
+		}
+		return;
+	}
+	ht->ht_where = cpu;
+}
+
+static
+unsigned
+topo_where(void)
+{
+	return ((struct hthread *)curthread)->ht_where;
+}
+
+/*
+ * Called by the waker, once T is awake but before it gets out of its
+ * wait.
+ */
+static
+void
+topo_wakeplace(struct thread *t, unsigned cpu)
+{
+	struct hthread *ht = (struct hthread *)t;
+
+	pthread_mutex_lock(&ht->ht_placelock);
+	if (ht->ht_where != cpu) {
+		topo_pin(ht, cpu);
+	}
+	pthread_mutex_unlock(&ht->ht_placelock);
+}
+
+/*
+ * About to block until WOKEN is set: undo the last wakeup's placement,
+ * if any. If we've already been woken, the waker's placement is next
+ * or done, and it's for this wakeup, so leave it alone.
+ */
+static
+void
+topo_unplace(struct hthread *ht, volatile unsigned *woken)
+{
+	if (topo_size == 0) {
+		return;
+	}
+	pthread_mutex_lock(&ht->ht_placelock);
+	if (__atomic_load_n(woken, __ATOMIC_ACQUIRE) == 0 &&
+	    ht->ht_where != ht->ht_cpu.c_number) {
+		topo_pin(ht, ht->ht_cpu.c_number);
+	}
+	pthread_mutex_unlock(&ht->ht_placelock);
+}
+
+static
+void
+topo_bootstrap(void)
+{
+	const char *size;
+	unsigned i;
+
+	size = getenv("HOST_CLUSTERS");
+	topo_size = size != NULL ? strtoul(size, NULL, 0) : 0;
+	if (topo_size == 0) {
+		return;
+	}
+	for (i = 0; i < HOST_MAXCPUS; i++) {
+		synch_cluster_set(i, (i % host_ncpus() / topo_size) %
+				  SYNCH_MAXCLUSTERS);
+	}
+	if (!sim_on) {
+		synch_wake_placer(topo_where, topo_wakeplace);
+	}
+}
+
+/*
+ * Pin the calling thread, HT, per the above.
+ */
+static
+void
+topo_place(struct hthread *ht)
+{
+	ht->ht_pthread = pthread_self();
+	ht->ht_where = ht->ht_cpu.c_number;
+	pthread_mutex_init(&ht->ht_placelock, NULL);
+	if (topo_size == 0) {
+		return;
+	}
+	topo_pin(ht, ht->ht_cpu.c_number);
+}
+
+////////////////////////////////////////////////////////////
+// threads
+
+/*
+ * Set up a kernel thread with a CPU of its own. The pthread that runs
+ * it installs it as curcpu.
+ */
+static
+void
+hthread_init(struct hthread *ht, const char *name)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&cpus_lock);
+	for (i = 0; i < HOST_MAXCPUS; i++) {
+		if (!cpus_used[i]) {
+			break;
+		}
+	}
+	if (i == HOST_MAXCPUS) {
+		panic("Out of CPUs (more than %u threads)\n", HOST_MAXCPUS);
+	}
+	cpus_used[i] = true;
+	pthread_mutex_unlock(&cpus_lock);
+
+	ht->ht_thread.t_name = kstrdup(name);
+	ht->ht_thread.t_cpu = &ht->ht_cpu;
+	ht->ht_thread.t_in_interrupt = false;
+	ht->ht_cpu.c_self = &ht->ht_cpu;
+	ht->ht_cpu.c_number = i;
+	ht->ht_cpu.c_curthread = &ht->ht_thread;
+	ht->ht_cpu.c_spinlocks = 0;
+
+	if (sim_on) {
+		pthread_cond_init(&ht->ht_simcv, NULL);
+		pthread_mutex_lock(&sim_lock);
+		ht->ht_runnable = true;
+		ht->ht_wakeat = 0;
+		sim_threads[i] = ht;
+		pthread_mutex_unlock(&sim_lock);
+	}
+}
+
+static
+void
+hthread_detach(void *arg)
+{
+	struct hthread *ht = arg;
+	unsigned n = ht->ht_cpu.c_number;
+
+	KASSERT(ht->ht_cpu.c_spinlocks == 0);
+	rcu_idle_enter();
+
+	pthread_mutex_lock(&cpus_lock);
+	cpus_used[n] = false;
+	pthread_mutex_unlock(&cpus_lock);
+
+	if (sim_on) {
+		/* Nobody can pick us once we're off the list. */
+		pthread_mutex_lock(&sim_lock);
+		sim_threads[n] = NULL;
+		pthread_mutex_unlock(&sim_lock);
+		pthread_cond_destroy(&ht->ht_simcv);
+	}
+
+	host_curcpu = NULL;
+	kfree(ht->ht_thread.t_name);
+	kfree(ht);
+
+	pthread_mutex_lock(&threads_lock);
+	if (--threads_running == 0) {
+		pthread_cond_broadcast(&threads_cv);
+		if (sim_on) {
+			pthread_mutex_lock(&sim_lock);
+			if (sim_joiner != NULL) {
+				sim_joiner->ht_runnable = true;
+			}
+			pthread_mutex_unlock(&sim_lock);
+		}
+	}
+	pthread_mutex_unlock(&threads_lock);
+
+	/* Last of all, so we're done with the heap by the time it's run. */
+	if (sim_on) {
+		pthread_mutex_lock(&sim_lock);
+		sim_run(NULL, sim_pick(NULL, false));
+		pthread_mutex_unlock(&sim_lock);
+	}
+}
+
+static
+void *
+hthread_start(void *arg)
+{
+	struct hthread *ht = arg;
+
+	host_curcpu = &ht->ht_cpu;
+	topo_place(ht);
+	if (sim_on) {
+		pthread_mutex_lock(&sim_lock);
+		while (sim_current != ht) {
+			pthread_cond_wait(&ht->ht_simcv, &sim_lock);
+		}
+		pthread_mutex_unlock(&sim_lock);
+	}
+	/*
+	 * As thread_startup does, so that grace periods wait for us; the
+	 * CPU may have been left idle by a thread that exited.
+	 */
+	rcu_idle_exit();
+	rcu_quiescent_state();
+	pthread_cleanup_push(hthread_detach, ht);
+	ht->ht_func(ht->ht_data1, ht->ht_data2);
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+int
+thread_fork(const char *name, struct proc *proc,
+	    void (*func)(void *, unsigned long),
+	    void *data1, unsigned long data2)
+{
+	struct hthread *ht;
+	pthread_t tid;
+	int err;
+
+	(void)proc;
+
+	ht = kmalloc(sizeof(*ht));
+	if (ht == NULL) {
+		return ENOMEM;
+	}
+	ht->ht_func = func;
+	ht->ht_data1 = data1;
+	ht->ht_data2 = data2;
+
+	/* Take the CPU here, so running out is the caller's problem. */
+	hthread_init(ht, name);
+
+	pthread_mutex_lock(&threads_lock);
+	threads_running++;
+	pthread_mutex_unlock(&threads_lock);
+
+	err = pthread_create(&tid, NULL, hthread_start, ht);
+	if (err) {
+		panic("thread_fork: pthread_create: %s\n", strerror(err));
+	}
+	pthread_detach(tid);
+	return 0;
+}
+
+void
+thread_yield(void)
+{
+	rcu_quiescent_state();
+	if (sim_on) {
+		sim_yield();
+	}
+	else {
+		sched_yield();
+	}
+}
+
+void
+thread_exit(void)
+{
+	pthread_exit(NULL);
+}
+
+////////////////////////////////////////////////////////////
+// host-only
+
+void
+host_bootstrap(void)
+{
+	struct hthread *ht;
+
+	KASSERT(host_curcpu == NULL);
+	ht = kmalloc(sizeof(*ht));
+	KASSERT(ht != NULL);
+	hthread_init(ht, "main");
+	host_curcpu = &ht->ht_cpu;
+	KASSERT(curcpu->c_number == 0);
+	sim_bootstrap(ht);
+	topo_bootstrap();
+	topo_place(ht);
+	synch_bootstrap();
+}
+
+void
+host_join(void)
+{
+	struct hthread *self;
+
+	if (sim_on) {
+		/* Only the running thread touches threads_running. */
+		rcu_idle_enter();
+		self = sim_self();
+		pthread_mutex_lock(&sim_lock);
+		while (threads_running > 0) {
+			sim_joiner = self;
+			sim_block(self);
+		}
+		sim_joiner = NULL;
+		pthread_mutex_unlock(&sim_lock);
+		rcu_idle_exit();
+		return;
+	}
+
+	pthread_mutex_lock(&threads_lock);
+	rcu_idle_enter();
+	while (threads_running > 0) {
+		pthread_cond_wait(&threads_cv, &threads_lock);
+	}
+	rcu_idle_exit();
+	pthread_mutex_unlock(&threads_lock);
+}
+
+unsigned
+host_ncpus(void)
+{
+	long n;
+
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
@@ -0,0 +1,426 @@
+/*
+ * tracedecode: turn a sync event trace written by synch_trace_dump
+ * into a timeline per object.
+ *
+ *    tracedecode [-s] tracefile [object]
+ *
+ * Records from all CPUs are merged by time. SLEEP and WAKEUP records
+ * carry a wait table key rather than the object, so they are put
+ * under whatever object the sleeping thread last contended on; WAKE
+ * records go under the object that key was last seen with. Waits
+ * (CONTEND to ACQUIRE) and hold times (ACQUIRE to RELEASE or HANDOFF)
+ * are worked out per thread and shown next to the events that end
+ * them. An rwlock upgrade or downgrade ends one hold and starts
+ * another, in the new mode; both events say "mode change".
+ *
+ * With -s only a summary line per object is printed. With OBJECT (in
+ * hex) only that object's timeline is.
+ *
+ * This is a host program; it doesn't link with the kernel code.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <types.h>
+#include <synch.h>
+#include "traceread.h"
+
+struct event {
+	struct synch_trace_rec e_rec;
+	uint32_t e_object;	/* object it belongs under */
+	uint64_t e_span;	/* wait or hold time it ends, or 0 */
+	unsigned e_seq;		/* position in the file, for stable sorts */
+};
+
+/*
+ * Map from a 64-bit key to a 64-bit value, open addressing. Sized up
+ * front to twice the number of records, so it never fills.
+ */
+struct map {
+	uint64_t *m_keys;	/* 0 is empty; keys are stored +1 */
+	uint64_t *m_vals;
+	size_t m_size;		/* power of 2 */
+};
+
+static const char *const evnames[] = {
+	[SYNCH_TR_CONTEND] = "contend",
+	[SYNCH_TR_SLEEP] = "sleep",
+	[SYNCH_TR_WAKEUP] = "wakeup",
+	[SYNCH_TR_ACQUIRE] = "acquire",
+	[SYNCH_TR_HANDOFF] = "handoff",
+	[SYNCH_TR_RELEASE] = "release",
+	[SYNCH_TR_WAKE] = "wake",
+	[SYNCH_TR_SIGNAL] = "signal",
+};
+
+#define NEVENTS (sizeof(evnames) / sizeof(evnames[0]))
+
+static const char *const kindnames[] = {
+	[SYNCH_KIND_SEM] = "sem",
+	[SYNCH_KIND_LOCK] = "lock",
+	[SYNCH_KIND_CV] = "cv",
+	[SYNCH_KIND_RWLOCK] = "rwlock",
+};
+
+#define NKINDS (sizeof(kindnames) / sizeof(kindnames[0]))
+
+static
+void *
+xmalloc(size_t len)
+{
+	void *p;
+
+	p = calloc(1, len ? len : 1);
+	if (p == NULL) {
+		fprintf(stderr, "tracedecode: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+static
+void
+map_init(struct map *m, size_t n)
+{
+	m->m_size = 16;
+	while (m->m_size < 2 * n) {
+		m->m_size *= 2;
+	}
+	m->m_keys = xmalloc(m->m_size * sizeof(uint64_t));
+	m->m_vals = xmalloc(m->m_size * sizeof(uint64_t));
+}
+
+static
+uint64_t *
+map_slot(struct map *m, uint64_t key, bool create)
+{
+	size_t i;
+
+	key++;
+	i = (size_t)(key * 0x9e3779b97f4a7c15ULL) & (m->m_size - 1);
+	while (m->m_keys[i] != 0 && m->m_keys[i] != key) {
+		i = (i + 1) & (m->m_size - 1);
+	}
+	if (m->m_keys[i] == 0) {
+		if (!create) {
+			return NULL;
+		}
+		m->m_keys[i] = key;
+		m->m_vals[i] = 0;
+	}
+	return &m->m_vals[i];
+}
+
+static
+uint64_t
+pairkey(uint32_t a, uint32_t b)
+{
+	return ((uint64_t)a << 32) | b;
+}
+
+////////////////////////////////////////////////////////////
+// reading
+
+static
+struct event *
+readtrace(const char *path, unsigned *nret)
+{
+	struct synch_trace_rec *recs;
+	struct event *ev;
+	unsigned i;
+
+	recs = traceread("tracedecode", path, nret, NULL);
+	ev = xmalloc(*nret * sizeof(*ev));
+	for (i = 0; i < *nret; i++) {
+		ev[i].e_rec = recs[i];
+		ev[i].e_object = recs[i].tr_object;
+		ev[i].e_seq = i;
+	}
+	free(recs);
+	return ev;
+}
+
+////////////////////////////////////////////////////////////
+// analysis
+
+static
+int
+bytime(const void *a, const void *b)
+{
+	const struct event *x = a, *y = b;
+
+	if (x->e_rec.tr_time != y->e_rec.tr_time) {
+		return x->e_rec.tr_time < y->e_rec.tr_time ? -1 : 1;
+	}
+	return x->e_seq < y->e_seq ? -1 : x->e_seq > y->e_seq;
+}
+
+static
+int
+byobject(const void *a, const void *b)
+{
+	const struct event *x = a, *y = b;
+
+	if (x->e_object != y->e_object) {
+		return x->e_object < y->e_object ? -1 : 1;
+	}
+	return bytime(a, b);
+}
+
+/*
+ * Work out which object each event belongs under and what it ends.
+ * EV is in time order.
+ */
+static
+void
+attribute(struct event *ev, unsigned n)
+{
+	struct map contending;	/* thread -> object it waits for, + 1 */
+	struct map keyobj;	/* key -> object */
+	struct map since;	/* (thread, object) -> contend/acquire time */
+	struct synch_trace_rec *tr;
+	uint64_t *v;
+	unsigned i;
+
+	map_init(&contending, n);
+	map_init(&keyobj, n);
+	map_init(&since, n);
+
+	for (i = 0; i < n; i++) {
+		tr = &ev[i].e_rec;
+		switch (tr->tr_event) {
+		    case SYNCH_TR_CONTEND:
+			*map_slot(&contending, tr->tr_thread, true) =
+				tr->tr_object + 1ULL;
+			*map_slot(&since, pairkey(tr->tr_thread,
+						  tr->tr_object), true) =
+				tr->tr_time;
+			break;
+		    case SYNCH_TR_SLEEP:
+		    case SYNCH_TR_WAKEUP:
+			v = map_slot(&contending, tr->tr_thread, false);
+			if (v != NULL && *v != 0) {
+				ev[i].e_object = *v - 1;
+				*map_slot(&keyobj, tr->tr_object, true) = *v;
+			}
+			break;
+		    case SYNCH_TR_WAKE:
+			v = map_slot(&keyobj, tr->tr_object, false);
+			if (v != NULL) {
+				ev[i].e_object = *v - 1;
+			}
+			break;
+		    case SYNCH_TR_ACQUIRE:
+			v = map_slot(&contending, tr->tr_thread, false);
+			if (v != NULL && *v == tr->tr_object + 1ULL) {
+				/* Waited; the contend time is in SINCE. */
+				*v = 0;
+				ev[i].e_span = tr->tr_time -
+					*map_slot(&since,
+						  pairkey(tr->tr_thread,
+							  tr->tr_object),
+						  true);
+			}
+			*map_slot(&since, pairkey(tr->tr_thread,
+						  tr->tr_object), true) =
+				tr->tr_time;
+			break;
+		    case SYNCH_TR_HANDOFF:
+		    case SYNCH_TR_RELEASE:
+			v = map_slot(&since, pairkey(tr->tr_thread,
+						     tr->tr_object), false);
+			if (v != NULL && *v != 0) {
+				ev[i].e_span = tr->tr_time - *v;
+				*v = 0;
+			}
+			break;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// output
+
+static
+const char *
+evname(unsigned event)
+{
+	if (event < NEVENTS && evnames[event] != NULL) {
+		return evnames[event];
+	}
+	return "?";
+}
+
+static
+const char *
+kindname(unsigned kind)
+{
+	if (kind < NKINDS && kindnames[kind] != NULL) {
+		return kindnames[kind];
+	}
+	return "?";
+}
+
+static
+void
+printevent(const struct event *e, uint64_t t0)
+{
+	const struct synch_trace_rec *tr = &e->e_rec;
+
+	printf("  %12.3f us  cpu %2u  thread 0x%08x  %-8s",
+	       (tr->tr_time - t0) / 1000.0, tr->tr_cpu, tr->tr_thread,
+	       evname(tr->tr_event));
+	switch (tr->tr_event) {
+	    case SYNCH_TR_SLEEP:
+	    case SYNCH_TR_WAKEUP:
+		printf("  key 0x%08x", tr->tr_object);
+		break;
+	    case SYNCH_TR_WAKE:
+		printf("  key 0x%08x%s", tr->tr_object,
+		       tr->tr_arg ? " all" : "");
+		break;
+	    case SYNCH_TR_SIGNAL:
+		printf("%s", SYNCH_TR_FLAG(tr->tr_arg) ? "  broadcast" : "");
+		break;
+	    case SYNCH_TR_CONTEND:
+		printf("%s", SYNCH_TR_FLAG(tr->tr_arg) ? "  write" : "");
+		printf("%s", SYNCH_TR_MODE(tr->tr_arg) ? "  mode change" : "");
+		break;
+	    case SYNCH_TR_ACQUIRE:
+		printf("%s", SYNCH_TR_FLAG(tr->tr_arg) ? "  write" : "");
+		printf("%s", SYNCH_TR_MODE(tr->tr_arg) ? "  mode change" : "");
+		if (e->e_span) {
+			printf("  waited %llu ns",
+			       (unsigned long long)e->e_span);
+		}
+		break;
+	    case SYNCH_TR_HANDOFF:
+	    case SYNCH_TR_RELEASE:
+		printf("%s", SYNCH_TR_FLAG(tr->tr_arg) ? "  write" : "");
+		printf("%s", SYNCH_TR_MODE(tr->tr_arg) ? "  mode change" : "");
+		if (e->e_span) {
+			printf("  held %llu ns",
+			       (unsigned long long)e->e_span);
+		}
+		break;
+	}
+	printf("\n");
+}
+
+/*
+ * One line for the events EV[0..N), all for the same object.
+ */
+static
+void
+printsummary(const struct event *ev, unsigned n)
+{
+	unsigned acquires = 0, contended = 0, handoffs = 0, i;
+	uint64_t waited = 0, maxwait = 0, maxhold = 0;
+	const char *kind = "?";
+
+	for (i = 0; i < n; i++) {
+		switch (ev[i].e_rec.tr_event) {
+		    case SYNCH_TR_SLEEP:
+		    case SYNCH_TR_WAKEUP:
+		    case SYNCH_TR_WAKE:
+			break;
+		    default:
+			kind = kindname(SYNCH_TR_KIND(ev[i].e_rec.tr_arg));
+			break;
+		}
+		switch (ev[i].e_rec.tr_event) {
+		    case SYNCH_TR_ACQUIRE:
+			acquires++;
+			if (ev[i].e_span) {
+				contended++;
+				waited += ev[i].e_span;
+				if (ev[i].e_span > maxwait) {
+					maxwait = ev[i].e_span;
+				}
+			}
+			break;
+		    case SYNCH_TR_HANDOFF:
+			handoffs++;
+			/* fall through */
+		    case SYNCH_TR_RELEASE:
+			if (ev[i].e_span > maxhold) {
+				maxhold = ev[i].e_span;
+			}
+			break;
+		}
+	}
+	printf("0x%08x %-6s  events %u  acquires %u  contended %u  "
+	       "handoffs %u  wait total %llu max %llu ns  hold max %llu ns\n",
+	       ev[0].e_object, kind, n, acquires, contended, handoffs,
+	       (unsigned long long)waited, (unsigned long long)maxwait,
+	       (unsigned long long)maxhold);
+}
+
+static
+void
+usage(void)
+{
+	fprintf(stderr, "Usage: tracedecode [-s] tracefile [object]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct event *ev;
+	bool summary = false, only = false;
+	uint32_t object = 0;
+	unsigned n, i, j;
+	uint64_t t0;
+	char *end;
+
+	if (argc > 1 && !strcmp(argv[1], "-s")) {
+		summary = true;
+		argc--;
+		argv++;
+	}
+	if (argc < 2 || argc > 3) {
+		usage();
+	}
+	if (argc == 3) {
+		object = strtoul(argv[2], &end, 16);
+		if (*end != 0) {
+			usage();
+		}
+		only = true;
+	}
+
+	ev = readtrace(argv[1], &n);
+	if (n == 0) {
+		return 0;
+	}
+
+	qsort(ev, n, sizeof(*ev), bytime);
+	t0 = ev[0].e_rec.tr_time;
+	attribute(ev, n);
+	qsort(ev, n, sizeof(*ev), byobject);
+
+	for (i = 0; i < n; i = j) {
+		for (j = i; j < n && ev[j].e_object == ev[i].e_object; j++) {
+			/* nothing */
+		}
+		if (only && ev[i].e_object != object) {
+			continue;
+		}
+		if (summary) {
+			printsummary(&ev[i], j - i);
+			continue;
+		}
+		printf("object 0x%08x\n", ev[i].e_object);
+		for (; i < j; i++) {
+			printevent(&ev[i], t0);
+		}
+	}
+
+	free(ev);
+	return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * Reading sync trace dumps, for the host tools; see traceread.h.
+ *
+ * The dump is in the byte order of the machine that wrote it; this
+ * works either way.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <types.h>
+#include <synch.h>
+#include "traceread.h"
+
+static
+uint16_t
+swap16(uint16_t v)
+{
+	return (v >> 8) | (v << 8);
+}
+
+static
+uint32_t
+swap32(uint32_t v)
+{
+	return ((uint32_t)swap16(v) << 16) | swap16(v >> 16);
+}
+
+static
+uint64_t
+swap64(uint64_t v)
+{
+	return ((uint64_t)swap32(v) << 32) | swap32(v >> 32);
+}
+
+struct synch_trace_rec *
+traceread(const char *prog, const char *path, unsigned *nret,
+	  unsigned *dropped)
+{
+	struct synch_trace_header sth;
+	struct synch_trace_rec *recs, *tr;
+	bool swap;
+	FILE *f;
+	unsigned i;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	if (fread(&sth, sizeof(sth), 1, f) != 1) {
+		fprintf(stderr, "%s: %s: short header\n", prog, path);
+		exit(1);
+	}
+
+	swap = (sth.sth_magic != SYNCH_TRACE_MAGIC);
+	if (swap) {
+		sth.sth_magic = swap32(sth.sth_magic);
+		sth.sth_version = swap16(sth.sth_version);
+		sth.sth_recsize = swap16(sth.sth_recsize);
+		sth.sth_nrecs = swap32(sth.sth_nrecs);
+		sth.sth_dropped = swap32(sth.sth_dropped);
+	}
+	if (sth.sth_magic != SYNCH_TRACE_MAGIC) {
+		fprintf(stderr, "%s: %s: not a sync trace\n", prog, path);
+		exit(1);
+	}
+	if (sth.sth_version != SYNCH_TRACE_VERSION ||
+	    sth.sth_recsize != sizeof(struct synch_trace_rec)) {
+		fprintf(stderr, "%s: %s: version %u, record size %u; expected "
+			"%u and %zu\n", prog, path, sth.sth_version,
+			sth.sth_recsize, SYNCH_TRACE_VERSION,
+			sizeof(struct synch_trace_rec));
+		exit(1);
+	}
+	if (sth.sth_dropped > 0) {
+		fprintf(stderr, "%s: %s: %u records were overwritten; the "
+			"trace starts late\n", prog, path, sth.sth_dropped);
+	}
+
+	recs = calloc(sth.sth_nrecs ? sth.sth_nrecs : 1, sizeof(*recs));
+	if (recs == NULL) {
+		fprintf(stderr, "%s: out of memory\n", prog);
+		exit(1);
+	}
+	for (i = 0; i < sth.sth_nrecs; i++) {
+		tr = &recs[i];
+		if (fread(tr, sizeof(*tr), 1, f) != 1) {
+			fprintf(stderr, "%s: %s: truncated after %u records\n",
+				prog, path, i);
+			break;
+		}
+		if (swap) {
+			tr->tr_time = swap64(tr->tr_time);
+			tr->tr_object = swap32(tr->tr_object);
+			tr->tr_thread = swap32(tr->tr_thread);
+			tr->tr_cpu = swap16(tr->tr_cpu);
+			tr->tr_event = swap16(tr->tr_event);
+			tr->tr_arg = swap32(tr->tr_arg);
+		}
+	}
+	fclose(f);
+
+	*nret = i;
+	if (dropped != NULL) {
+		*dropped = sth.sth_dropped;
+	}
+	return recs;
+}
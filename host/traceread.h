@@ -0,0 +1,20 @@
+/*
+ * Reading sync trace dumps, for the host tools.
+ *
+ *    traceread - Read the dump at PATH, written by synch_trace_dump,
+ *                and return its records in the byte order of this
+ *                machine, with their number in NRET. Complains and
+ *                exits, prefixing messages with PROG, if the file
+ *                can't be read or isn't a dump of this version.
+ *                If DROPPED isn't NULL, the number of records
+ *                overwritten before the dump is put there. Free the
+ *                result with free().
+ */
+
+#ifndef _TRACEREAD_H_
+#define _TRACEREAD_H_
+
+struct synch_trace_rec *traceread(const char *prog, const char *path,
+				  unsigned *nret, unsigned *dropped);
+
+#endif /* _TRACEREAD_H_ */
@@ -0,0 +1,916 @@
+/*
+ * tracereplay: play the critical sections in a sync event trace,
+ * written by synch_trace_dump, back against the primitives in
+ * synch.c, to see how another lock would have done on the same
+ * workload.
+ *
+ *    tracereplay [-i impl] [-x speedup] tracefile
+ *
+ * Each thread in the trace becomes a thread here, and does what it
+ * did in the trace: acquire and release the same objects, in the same
+ * order, running (spinning) for as long as it did between one
+ * acquire or release and the next. So the hold times and the time
+ * between critical sections come from the trace; the waits come from
+ * the implementation being tried.
+ *
+ * What gets replayed is the locks, the rwlocks, and the semaphores
+ * that were used as locks (never held by more than one thread at a
+ * time, and released by the thread that took them). The rest (CVs,
+ * semaphores used for signalling) isn't, and time spent waiting on
+ * them counts as running. Sections held when the trace started are
+ * left out, and sections still held when it ended are closed at once.
+ * If records were overwritten, each CPU's ring lost its oldest ones
+ * separately, so only the stretch that every CPU's records cover is
+ * replayed; otherwise a section could start on one CPU and have its
+ * end lost on another.
+ * A thread address the kernel reused shows up as one thread.
+ *
+ * IMPL picks what the locks and lock-like semaphores are replayed
+ * with; see rpimpls below. By default each is replayed with what it
+ * was. rwlocks are always replayed as rwlocks, an upgradable read as
+ * a read, and an upgrade or downgrade as a release in the old mode
+ * followed by an acquire in the new one. SPEEDUP divides all the
+ * running times, to make the locks more contended than they were.
+ *
+ * For each object, prints the number of acquisitions and the p50 and
+ * p99 wait in the trace and in the replay, and then the same for all
+ * of them together with the elapsed time and acquisitions per second.
+ *
+ * Links with libsynch.a; see host.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <host.h>
+#include <unistd.h>
+#include "traceread.h"
+
+#define RP_ACQUIRE	0
+#define RP_RELEASE	1
+
+/*
+ * One step of a thread's script: run for O_DELAY ns, then acquire or
+ * release O_OBJ.
+ */
+struct rpop {
+	uint64_t o_delay;
+	uint64_t o_waited;	/* trace, then replay; acquires only */
+	unsigned o_obj;		/* index in rp_objs */
+	unsigned o_op;		/* RP_ACQUIRE or RP_RELEASE */
+	bool o_write;
+};
+
+struct rpthread {
+	uint32_t t_addr;
+	struct rpop *t_ops;
+	unsigned t_nops, t_maxops;
+
+	/* While building the script. */
+	uint64_t t_last;	/* time of the previous step */
+	uint32_t t_contend;	/* object it's waiting for, or 0 */
+	uint64_t t_contendtime;
+	unsigned *t_held;	/* acquires not released, in order */
+	unsigned t_nheld, t_maxheld;
+};
+
+struct rpobj {
+	uint32_t r_addr;
+	unsigned r_kind;	/* SYNCH_KIND_* */
+	unsigned r_holders;	/* now, while building */
+	unsigned r_maxholders;
+	unsigned r_strays;	/* releases by a thread not holding it */
+	bool r_replay;
+	const struct rpimpl *r_impl;
+	void *r_prim;
+};
+
+/*
+ * What an object can be replayed with.
+ */
+struct rpimpl {
+	const char *ri_name;
+	void *(*ri_create)(const char *name);
+	void (*ri_destroy)(void *);
+	void (*ri_acquire)(void *, bool write);
+	void (*ri_release)(void *, bool write);
+};
+
+static struct rpobj *rp_objs;
+static unsigned rp_nobjs;
+static struct rpthread *rp_threads;
+static unsigned rp_nthreads;
+static double rp_speedup = 1;
+static struct barrier *rp_start;
+
+////////////////////////////////////////////////////////////
+// implementations
+
+static
+void *
+rp_lock_create(const char *name)
+{
+	return lock_create(name);
+}
+
+static
+void
+rp_lock_destroy(void *p)
+{
+	lock_destroy(p);
+}
+
+static
+void
+rp_lock_acquire(void *p, bool write)
+{
+	(void)write;
+	lock_acquire(p);
+}
+
+static
+void
+rp_lock_release(void *p, bool write)
+{
+	(void)write;
+	lock_release(p);
+}
+
+static
+void *
+rp_sem_create(const char *name)
+{
+	return sem_create(name, 1);
+}
+
+static
+void
+rp_sem_destroy(void *p)
+{
+	sem_destroy(p);
+}
+
+static
+void
+rp_sem_acquire(void *p, bool write)
+{
+	(void)write;
+	P(p);
+}
+
+static
+void
+rp_sem_release(void *p, bool write)
+{
+	(void)write;
+	V(p);
+}
+
+static
+void *
+rp_cohort_create(const char *name)
+{
+	return cohortlock_create(name);
+}
+
+static
+void
+rp_cohort_destroy(void *p)
+{
+	cohortlock_destroy(p);
+}
+
+static
+void
+rp_cohort_acquire(void *p, bool write)
+{
+	(void)write;
+	cohortlock_acquire(p);
+}
+
+static
+void
+rp_cohort_release(void *p, bool write)
+{
+	(void)write;
+	cohortlock_release(p);
+}
+
+static
+void *
+rp_rwlock_create(const char *name)
+{
+	return rwlock_create(name);
+}
+
+static
+void
+rp_rwlock_destroy(void *p)
+{
+	rwlock_destroy(p);
+}
+
+static
+void
+rp_rwlock_acquire(void *p, bool write)
+{
+	if (write) {
+		rwlock_acquire_write(p);
+	}
+	else {
+		rwlock_acquire_read(p);
+	}
+}
+
+static
+void
+rp_rwlock_release(void *p, bool write)
+{
+	if (write) {
+		rwlock_release_write(p);
+	}
+	else {
+		rwlock_release_read(p);
+	}
+}
+
+/*
+ * For -i. An rwlock used for locks takes every acquisition as a write.
+ */
+static const struct rpimpl rpimpls[] = {
+	{ "lock", rp_lock_create, rp_lock_destroy,
+	  rp_lock_acquire, rp_lock_release },
+	{ "sem", rp_sem_create, rp_sem_destroy,
+	  rp_sem_acquire, rp_sem_release },
+	{ "cohort", rp_cohort_create, rp_cohort_destroy,
+	  rp_cohort_acquire, rp_cohort_release },
+	{ "rwlock", rp_rwlock_create, rp_rwlock_destroy,
+	  rp_rwlock_acquire, rp_rwlock_release },
+};
+
+#define NIMPLS (sizeof(rpimpls) / sizeof(rpimpls[0]))
+
+static
+const struct rpimpl *
+rp_findimpl(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < NIMPLS; i++) {
+		if (!strcmp(rpimpls[i].ri_name, name)) {
+			return &rpimpls[i];
+		}
+	}
+	return NULL;
+}
+
+////////////////////////////////////////////////////////////
+// building the scripts
+
+static
+void *
+rp_grow(void *p, unsigned *max, size_t size)
+{
+	*max = *max ? *max * 2 : 16;
+	p = realloc(p, *max * size);
+	if (p == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+/* For rp_bytime, which sorts indexes into it. */
+static const struct synch_trace_rec *rp_sorting;
+
+static
+int
+rp_bytime(const void *a, const void *b)
+{
+	unsigned x = *(const unsigned *)a, y = *(const unsigned *)b;
+
+	if (rp_sorting[x].tr_time != rp_sorting[y].tr_time) {
+		return rp_sorting[x].tr_time < rp_sorting[y].tr_time ? -1 : 1;
+	}
+	/* Same time: keep the file order, which is per CPU. */
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Put RECS in time order.
+ */
+static
+void
+rp_sort(struct synch_trace_rec *recs, unsigned n)
+{
+	struct synch_trace_rec *copy;
+	unsigned *order, i;
+
+	order = calloc(n ? n : 1, sizeof(*order));
+	copy = calloc(n ? n : 1, sizeof(*copy));
+	if (order == NULL || copy == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		order[i] = i;
+	}
+	rp_sorting = recs;
+	qsort(order, n, sizeof(*order), rp_bytime);
+	for (i = 0; i < n; i++) {
+		copy[i] = recs[order[i]];
+	}
+	memcpy(recs, copy, n * sizeof(*recs));
+	free(copy);
+	free(order);
+}
+
+static
+int
+rp_byaddr(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Sorted list of the distinct values of FIELD (an offset into a
+ * record) in the ACQUIRE records.
+ */
+static
+uint32_t *
+rp_distinct(const struct synch_trace_rec *recs, unsigned n, size_t field,
+	    unsigned *nret)
+{
+	uint32_t *v;
+	unsigned i, j;
+
+	v = calloc(n ? n : 1, sizeof(*v));
+	if (v == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	for (i = j = 0; i < n; i++) {
+		if (recs[i].tr_event == SYNCH_TR_ACQUIRE) {
+			v[j++] = *(const uint32_t *)((const char *)&recs[i] +
+						      field);
+		}
+	}
+	qsort(v, j, sizeof(*v), rp_byaddr);
+	for (i = *nret = 0; i < j; i++) {
+		if (i == 0 || v[i] != v[i - 1]) {
+			v[(*nret)++] = v[i];
+		}
+	}
+	return v;
+}
+
+static
+int
+rp_index(const uint32_t *addrs, unsigned n, uint32_t addr)
+{
+	const uint32_t *p;
+
+	p = bsearch(&addr, addrs, n, sizeof(*addrs), rp_byaddr);
+	return p == NULL ? -1 : (int)(p - addrs);
+}
+
+static
+void
+rp_addop(struct rpthread *t, unsigned obj, unsigned op, bool write,
+	 uint64_t delay, uint64_t waited)
+{
+	struct rpop *o;
+
+	if (t->t_nops == t->t_maxops) {
+		t->t_ops = rp_grow(t->t_ops, &t->t_maxops, sizeof(*t->t_ops));
+	}
+	o = &t->t_ops[t->t_nops++];
+	o->o_obj = obj;
+	o->o_op = op;
+	o->o_write = write;
+	o->o_delay = delay;
+	o->o_waited = waited;
+}
+
+static
+void
+rp_acquire(struct rpthread *t, const struct synch_trace_rec *tr,
+	   unsigned obj)
+{
+	struct rpobj *r = &rp_objs[obj];
+	uint64_t start;
+
+	start = tr->tr_time;
+	if (t->t_contend == tr->tr_object) {
+		start = t->t_contendtime;
+	}
+	t->t_contend = 0;
+	rp_addop(t, obj, RP_ACQUIRE, SYNCH_TR_FLAG(tr->tr_arg),
+		 start - t->t_last, tr->tr_time - start);
+	t->t_last = tr->tr_time;
+
+	if (t->t_nheld == t->t_maxheld) {
+		t->t_held = rp_grow(t->t_held, &t->t_maxheld,
+				    sizeof(*t->t_held));
+	}
+	t->t_held[t->t_nheld++] = t->t_nops - 1;
+	r->r_kind = SYNCH_TR_KIND(tr->tr_arg);
+	if (++r->r_holders > r->r_maxholders) {
+		r->r_maxholders = r->r_holders;
+	}
+}
+
+static
+void
+rp_release(struct rpthread *t, const struct synch_trace_rec *tr,
+	   unsigned obj)
+{
+	struct rpop *acq = NULL;
+	unsigned i;
+
+	for (i = t->t_nheld; i > 0; i--) {
+		acq = &t->t_ops[t->t_held[i - 1]];
+		if (acq->o_obj == obj) {
+			break;
+		}
+	}
+	if (i == 0) {
+		/* Taken before the trace started, or by someone else. */
+		rp_objs[obj].r_strays++;
+		return;
+	}
+	memmove(&t->t_held[i - 1], &t->t_held[i],
+		(t->t_nheld - i) * sizeof(*t->t_held));
+	t->t_nheld--;
+	rp_objs[obj].r_holders--;
+	rp_addop(t, obj, RP_RELEASE, acq->o_write, tr->tr_time - t->t_last, 0);
+	t->t_last = tr->tr_time;
+}
+
+/*
+ * Whether OBJ can be replayed: locks and rwlocks always; a semaphore
+ * if it looks like a lock. At most one stray release is allowed, for
+ * the holder when the trace started.
+ */
+static
+bool
+rp_replayable(const struct rpobj *r)
+{
+	switch (r->r_kind) {
+	    case SYNCH_KIND_LOCK:
+	    case SYNCH_KIND_RWLOCK:
+		return true;
+	    case SYNCH_KIND_SEM:
+		return r->r_maxholders <= 1 && r->r_strays <= 1;
+	}
+	return false;
+}
+
+/*
+ * Drop the steps on objects that aren't replayed, adding their
+ * running time to the next step. Then forget the threads with nothing
+ * left to do.
+ */
+static
+void
+rp_prune(void)
+{
+	struct rpthread *t;
+	uint64_t carry;
+	unsigned i, j, k, n;
+
+	for (i = n = 0; i < rp_nthreads; i++) {
+		t = &rp_threads[i];
+		carry = 0;
+		for (j = k = 0; j < t->t_nops; j++) {
+			if (!rp_objs[t->t_ops[j].o_obj].r_replay) {
+				carry += t->t_ops[j].o_delay;
+				continue;
+			}
+			t->t_ops[k] = t->t_ops[j];
+			t->t_ops[k++].o_delay += carry;
+			carry = 0;
+		}
+		t->t_nops = k;
+		free(t->t_held);
+		if (k == 0) {
+			free(t->t_ops);
+			continue;
+		}
+		rp_threads[n++] = *t;
+	}
+	rp_nthreads = n;
+}
+
+/*
+ * Drop the records from before the latest of the CPUs' first records,
+ * keeping the file order; returns how many are left.
+ */
+static
+unsigned
+rp_trim(struct synch_trace_rec *recs, unsigned n)
+{
+	uint64_t *first, cutoff = 0;
+	unsigned i, j, ncpus = 0;
+
+	for (i = 0; i < n; i++) {
+		if (recs[i].tr_cpu >= ncpus) {
+			ncpus = recs[i].tr_cpu + 1;
+		}
+	}
+	/* 0 for a CPU with no records; times are never 0. */
+	first = calloc(ncpus ? ncpus : 1, sizeof(*first));
+	if (first == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < n; i++) {
+		if (first[recs[i].tr_cpu] == 0 ||
+		    recs[i].tr_time < first[recs[i].tr_cpu]) {
+			first[recs[i].tr_cpu] = recs[i].tr_time;
+		}
+	}
+	for (i = 0; i < ncpus; i++) {
+		if (first[i] > cutoff) {
+			cutoff = first[i];
+		}
+	}
+	free(first);
+
+	for (i = j = 0; i < n; i++) {
+		if (recs[i].tr_time >= cutoff) {
+			recs[j++] = recs[i];
+		}
+	}
+	return j;
+}
+
+static
+void
+rp_build(struct synch_trace_rec *recs, unsigned n)
+{
+	struct synch_trace_rec *tr;
+	struct rpthread *t;
+	struct rpop *acq;
+	uint32_t *objaddrs, *threadaddrs;
+	unsigned i, j;
+	int obj, th;
+
+	rp_sort(recs, n);
+
+	objaddrs = rp_distinct(recs, n,
+			       offsetof(struct synch_trace_rec, tr_object),
+			       &rp_nobjs);
+	threadaddrs = rp_distinct(recs, n,
+				  offsetof(struct synch_trace_rec, tr_thread),
+				  &rp_nthreads);
+	rp_objs = calloc(rp_nobjs ? rp_nobjs : 1, sizeof(*rp_objs));
+	rp_threads = calloc(rp_nthreads ? rp_nthreads : 1,
+			    sizeof(*rp_threads));
+	if (rp_objs == NULL || rp_threads == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < rp_nobjs; i++) {
+		rp_objs[i].r_addr = objaddrs[i];
+	}
+	for (i = 0; i < rp_nthreads; i++) {
+		rp_threads[i].t_addr = threadaddrs[i];
+		rp_threads[i].t_last = n > 0 ? recs[0].tr_time : 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		tr = &recs[i];
+		th = rp_index(threadaddrs, rp_nthreads, tr->tr_thread);
+		obj = rp_index(objaddrs, rp_nobjs, tr->tr_object);
+		if (th < 0 || obj < 0) {
+			continue;
+		}
+		t = &rp_threads[th];
+		switch (tr->tr_event) {
+		    case SYNCH_TR_CONTEND:
+			t->t_contend = tr->tr_object;
+			t->t_contendtime = tr->tr_time;
+			break;
+		    case SYNCH_TR_ACQUIRE:
+			rp_acquire(t, tr, obj);
+			break;
+		    case SYNCH_TR_HANDOFF:
+		    case SYNCH_TR_RELEASE:
+			rp_release(t, tr, obj);
+			break;
+		}
+	}
+
+	/* Close what's still held, innermost first. */
+	for (i = 0; i < rp_nthreads; i++) {
+		t = &rp_threads[i];
+		for (j = t->t_nheld; j > 0; j--) {
+			acq = &t->t_ops[t->t_held[j - 1]];
+			rp_addop(t, acq->o_obj, RP_RELEASE, acq->o_write, 0, 0);
+		}
+	}
+
+	for (i = 0; i < rp_nobjs; i++) {
+		rp_objs[i].r_replay = rp_replayable(&rp_objs[i]);
+	}
+	rp_prune();
+
+	free(objaddrs);
+	free(threadaddrs);
+}
+
+////////////////////////////////////////////////////////////
+// replay
+
+static
+uint64_t
+rp_now(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Run for NS nanoseconds.
+ */
+static
+void
+rp_run(uint64_t ns)
+{
+	uint64_t until;
+
+	ns = ns / rp_speedup;
+	if (ns == 0) {
+		return;
+	}
+	until = rp_now() + ns;
+	while (rp_now() < until) {
+		/* nothing */
+	}
+}
+
+static
+void
+rp_thread(void *p, unsigned long unused)
+{
+	struct rpthread *t = p;
+	struct rpop *o;
+	struct rpobj *r;
+	uint64_t start;
+	unsigned i;
+
+	(void)unused;
+
+	barrier_wait(rp_start);
+	for (i = 0; i < t->t_nops; i++) {
+		o = &t->t_ops[i];
+		r = &rp_objs[o->o_obj];
+		rp_run(o->o_delay);
+		if (o->o_op == RP_RELEASE) {
+			r->r_impl->ri_release(r->r_prim, o->o_write);
+			continue;
+		}
+		start = rp_now();
+		r->r_impl->ri_acquire(r->r_prim, o->o_write);
+		o->o_waited = rp_now() - start;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// output
+
+struct rpresult {
+	struct synch_hist s_trace;
+	struct synch_hist s_replay;
+	uint64_t s_acquires;
+};
+
+static
+void
+rp_printrow(const char *what, const char *impl, const struct rpresult *s)
+{
+	printf("%-10s %-6s %10llu %10llu %10llu %10llu %10llu\n",
+	       what, impl, (unsigned long long)s->s_acquires,
+	       (unsigned long long)synch_hist_percentile(&s->s_trace, 500),
+	       (unsigned long long)synch_hist_percentile(&s->s_trace, 990),
+	       (unsigned long long)synch_hist_percentile(&s->s_replay, 500),
+	       (unsigned long long)synch_hist_percentile(&s->s_replay, 990));
+}
+
+/*
+ * TRACEWAITS holds the recorded waits, taken from the scripts before
+ * the replay overwrote them.
+ */
+static
+void
+rp_report(const uint64_t *tracewaits, uint64_t traced, uint64_t replayed)
+{
+	struct rpresult *res, all;
+	struct rpthread *t;
+	struct rpop *o;
+	char addr[16];
+	unsigned i, j, k;
+
+	res = calloc(rp_nobjs ? rp_nobjs : 1, sizeof(*res));
+	if (res == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	memset(&all, 0, sizeof(all));
+
+	for (i = k = 0; i < rp_nthreads; i++) {
+		t = &rp_threads[i];
+		for (j = 0; j < t->t_nops; j++, k++) {
+			o = &t->t_ops[j];
+			if (o->o_op != RP_ACQUIRE) {
+				continue;
+			}
+			res[o->o_obj].s_acquires++;
+			synch_hist_record(&res[o->o_obj].s_trace,
+					  tracewaits[k]);
+			synch_hist_record(&res[o->o_obj].s_replay,
+					  o->o_waited);
+		}
+	}
+
+	printf("%-10s %-6s %10s %10s %10s %10s %10s\n", "object", "impl",
+	       "acquires", "trace p50", "p99", "replay p50", "p99");
+	for (i = 0; i < rp_nobjs; i++) {
+		if (!rp_objs[i].r_replay || res[i].s_acquires == 0) {
+			continue;
+		}
+		snprintf(addr, sizeof(addr), "0x%08x", rp_objs[i].r_addr);
+		rp_printrow(addr, rp_objs[i].r_impl->ri_name, &res[i]);
+		synch_hist_merge(&all.s_trace, &res[i].s_trace);
+		synch_hist_merge(&all.s_replay, &res[i].s_replay);
+		all.s_acquires += res[i].s_acquires;
+	}
+	rp_printrow("all", "", &all);
+
+	if (traced == 0) {
+		traced = 1;
+	}
+	if (replayed == 0) {
+		replayed = 1;
+	}
+	printf("trace  %llu ns  %llu acquires/s\n",
+	       (unsigned long long)traced,
+	       (unsigned long long)(all.s_acquires * 1000000000 / traced));
+	printf("replay %llu ns  %llu acquires/s  (speedup %g)\n",
+	       (unsigned long long)replayed,
+	       (unsigned long long)(all.s_acquires * 1000000000 / replayed),
+	       rp_speedup);
+	free(res);
+}
+
+////////////////////////////////////////////////////////////
+// main
+
+static
+void
+usage(void)
+{
+	unsigned i;
+
+	fprintf(stderr, "Usage: tracereplay [-i impl] [-x speedup] "
+		"tracefile\n");
+	fprintf(stderr, "impl is one of:");
+	for (i = 0; i < NIMPLS; i++) {
+		fprintf(stderr, " %s", rpimpls[i].ri_name);
+	}
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct synch_trace_rec *recs;
+	const struct rpimpl *impl = NULL;
+	uint64_t *tracewaits, traced, start, end;
+	struct rpobj *r;
+	unsigned n, i, j, k, nops, dropped, kept;
+	char name[32], *endp;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "i:x:")) != -1) {
+		switch (ch) {
+		    case 'i':
+			impl = rp_findimpl(optarg);
+			if (impl == NULL) {
+				usage();
+			}
+			break;
+		    case 'x':
+			rp_speedup = strtod(optarg, &endp);
+			if (*endp != 0 || !(rp_speedup > 0)) {
+				usage();
+			}
+			break;
+		    default:
+			usage();
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+	}
+
+	host_bootstrap();
+
+	recs = traceread("tracereplay", argv[optind], &n, &dropped);
+	if (dropped > 0) {
+		kept = rp_trim(recs, n);
+		fprintf(stderr, "tracereplay: replaying the last %u records, "
+			"which every CPU's ring still covers\n", kept);
+		n = kept;
+	}
+	rp_build(recs, n);
+	traced = n > 0 ? recs[n - 1].tr_time - recs[0].tr_time : 0;
+	free(recs);
+
+	if (rp_nthreads > HOST_MAXCPUS - 1) {
+		fprintf(stderr, "tracereplay: %u threads in the trace; the "
+			"host build runs at most %u\n", rp_nthreads,
+			HOST_MAXCPUS - 1);
+		exit(1);
+	}
+
+	for (i = nops = 0; i < rp_nthreads; i++) {
+		nops += rp_threads[i].t_nops;
+	}
+	tracewaits = calloc(nops ? nops : 1, sizeof(*tracewaits));
+	if (tracewaits == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	for (i = k = 0; i < rp_nthreads; i++) {
+		for (j = 0; j < rp_threads[i].t_nops; j++) {
+			tracewaits[k++] = rp_threads[i].t_ops[j].o_waited;
+		}
+	}
+
+	for (i = 0; i < rp_nobjs; i++) {
+		r = &rp_objs[i];
+		if (!r->r_replay) {
+			continue;
+		}
+		if (r->r_kind == SYNCH_KIND_RWLOCK) {
+			r->r_impl = rp_findimpl("rwlock");
+		}
+		else if (impl != NULL) {
+			r->r_impl = impl;
+		}
+		else {
+			r->r_impl = rp_findimpl(r->r_kind == SYNCH_KIND_SEM ?
+						"sem" : "lock");
+		}
+		snprintf(name, sizeof(name), "replay 0x%08x", r->r_addr);
+		r->r_prim = r->r_impl->ri_create(name);
+		if (r->r_prim == NULL) {
+			fprintf(stderr, "tracereplay: out of memory\n");
+			exit(1);
+		}
+	}
+
+	rp_start = barrier_create("replay start", rp_nthreads + 1);
+	if (rp_start == NULL) {
+		fprintf(stderr, "tracereplay: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < rp_nthreads; i++) {
+		snprintf(name, sizeof(name), "replay 0x%08x",
+			 rp_threads[i].t_addr);
+		if (thread_fork(name, NULL, rp_thread, &rp_threads[i], 0)) {
+			fprintf(stderr, "tracereplay: thread_fork failed\n");
+			exit(1);
+		}
+	}
+	barrier_wait(rp_start);
+	start = rp_now();
+	host_join();
+	end = rp_now();
+
+	rp_report(tracewaits, traced, end - start);
+
+	for (i = 0; i < rp_nobjs; i++) {
+		if (rp_objs[i].r_replay) {
+			rp_objs[i].r_impl->ri_destroy(rp_objs[i].r_prim);
+		}
+	}
+	barrier_destroy(rp_start);
+	for (i = 0; i < rp_nthreads; i++) {
+		free(rp_threads[i].t_ops);
+	}
+	free(rp_threads);
+	free(rp_objs);
+	free(tracewaits);
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Host build: the bits of the VFS layer the kernel code uses, on top
+ * of host files. Kept apart from shim.c because the host's <fcntl.h>
+ * and the kernel's <kern/fcntl.h> can't both be included.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* From <kern/fcntl.h>. */
+#define KO_ACCMODE	3
+#define KO_CREAT	4
+#define KO_EXCL		8
+#define KO_TRUNC	16
+#define KO_APPEND	32
+
+void
+uio_kinit(struct iovec *iov, struct uio *u,
+	  void *kbuf, size_t len, off_t pos, enum uio_rw rw)
+{
+	iov->iov_kbase = kbuf;
+	iov->iov_len = len;
+	u->uio_iov = iov;
+	u->uio_iovcnt = 1;
+	u->uio_offset = pos;
+	u->uio_resid = len;
+	u->uio_segflg = UIO_SYSSPACE;
+	u->uio_rw = rw;
+	u->uio_space = NULL;
+}
+
+int
+vfs_open(char *path, int openflags, mode_t mode, struct vnode **ret)
+{
+	static const int accmodes[] = { O_RDONLY, O_WRONLY, O_RDWR };
+	struct vnode *vn;
+	int flags, fd;
+
+	if ((openflags & KO_ACCMODE) == KO_ACCMODE) {
+		return EINVAL;
+	}
+	flags = accmodes[openflags & KO_ACCMODE];
+	flags |= (openflags & KO_CREAT) ? O_CREAT : 0;
+	flags |= (openflags & KO_EXCL) ? O_EXCL : 0;
+	flags |= (openflags & KO_TRUNC) ? O_TRUNC : 0;
+	flags |= (openflags & KO_APPEND) ? O_APPEND : 0;
+
+	vn = kmalloc(sizeof(*vn));
+	if (vn == NULL) {
+		return ENOMEM;
+	}
+	fd = open(path, flags, mode);
+	if (fd < 0) {
+		kfree(vn);
+		return errno;
+	}
+	vn->vn_fd = fd;
+	*ret = vn;
+	return 0;
+}
+
+void
+vfs_close(struct vnode *vn)
+{
+	close(vn->vn_fd);
+	kfree(vn);
+}
+
+int
+host_vop_write(struct vnode *vn, struct uio *u)
+{
+	struct iovec *iov;
+	ssize_t n;
+
+	KASSERT(u->uio_rw == UIO_WRITE);
+	KASSERT(u->uio_iovcnt == 1);
+
+	iov = u->uio_iov;
+	while (u->uio_resid > 0) {
+		n = pwrite(vn->vn_fd, iov->iov_kbase, u->uio_resid,
+			   u->uio_offset);
+		if (n < 0) {
+			return errno;
+		}
+		iov->iov_kbase = (char *)iov->iov_kbase + n;
+		iov->iov_len -= n;
+		u->uio_offset += n;
+		u->uio_resid -= n;
+	}
+	return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * RCU callback test.
+ *
+ * A reader thread sits in a read-side section while the main thread
+ * hands a callback to call_rcu; the callback must not run yet. Then
+ * the reader leaves the section and exits, and the main thread waits
+ * for it, and neither of them calls into RCU again: the callback has
+ * to be run by the grace period ending, from the context switch and
+ * idle hooks, and not by some later call_rcu or synchronize_rcu.
+ *
+ * Usage (kernel menu or host build):
+ *
+ *    rcut [rounds]
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <atomic.h>
+#include <test.h>
+
+#define RT_ROUNDS	10
+
+static struct rcu_head rt_head;
+static unsigned rt_ran;			/* times the callback has run */
+static unsigned rt_reading;		/* reader is in its section */
+static unsigned rt_go;			/* reader may leave it */
+static struct waitgroup *rt_done;
+
+static
+void
+rt_callback(struct rcu_head *head)
+{
+	KASSERT(head == &rt_head);
+	atomic_fetch_add(&rt_ran, 1);
+}
+
+static
+void
+rt_reader(void *unused1, unsigned long unused2)
+{
+	(void)unused1;
+	(void)unused2;
+
+	rcu_read_lock();
+	atomic_store(&rt_reading, 1);
+	while (atomic_load(&rt_go) == 0) {
+		atomic_pause();
+	}
+	rcu_read_unlock();
+	waitgroup_done(rt_done);
+}
+
+int
+rcutest(int nargs, char **args)
+{
+	unsigned i, tries, rounds;
+	int result;
+
+	rounds = nargs > 1 ? atoi(args[1]) : RT_ROUNDS;
+
+	rt_done = waitgroup_create("rcut done");
+	if (rt_done == NULL) {
+		return ENOMEM;
+	}
+
+	for (i = 0; i < rounds; i++) {
+		atomic_store(&rt_reading, 0);
+		atomic_store(&rt_go, 0);
+		waitgroup_add(rt_done, 1);
+		result = thread_fork("rcut reader", NULL, rt_reader, NULL, 0);
+		if (result) {
+			panic("rcutest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		while (atomic_load(&rt_reading) == 0) {
+			thread_yield();
+		}
+
+		call_rcu(&rt_head, rt_callback);
+		if (atomic_load(&rt_ran) != i) {
+			kprintf("rcut: callback ran inside a read-side "
+				"section\n");
+			waitgroup_destroy(rt_done);
+			return EINVAL;
+		}
+
+		atomic_store(&rt_go, 1);
+		waitgroup_wait(rt_done);
+
+		/*
+		 * The reader is out of its section but may not have
+		 * switched yet; keep switching ourselves until it has.
+		 * A grace period never takes long, so don't wait for
+		 * ever either.
+		 */
+		for (tries = 0; tries < 100000; tries++) {
+			if (atomic_load(&rt_ran) == i + 1) {
+				break;
+			}
+			thread_yield();
+		}
+		if (atomic_load(&rt_ran) != i + 1) {
+			kprintf("rcut: callback did not run after a grace "
+				"period (round %u)\n", i);
+			waitgroup_destroy(rt_done);
+			return EINVAL;
+		}
+	}
+
+	waitgroup_destroy(rt_done);
+	kprintf("rcut: %u rounds, test passed\n", rounds);
+	return 0;
+}
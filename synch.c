@@ -32,313 +32,3845 @@
  * The specifications of the functions are in synch.h.
  */
 
+/* Make sure to build out-of-line versions of atomic_* functions */
+#define ATOMIC_INLINE	/* empty */
+
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <atomic.h>
 #include <spl.h>
+#include <membar.h>
+#include <cpu.h>
+#include <clock.h>
+#include <kern/fcntl.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+
+/*
+ * The lean build (-DSYNCH_LEAN) leaves out everything that is there
+ * for debugging rather than for synchronizing: assertions, the
+ * deadlock detector hooks, the copies of the object names, and the
+ * statistics, call sites and hold limits, which are kept by name and
+ * so would have nothing to go on. Tracing stays; it costs one load
+ * while it is off. The structures in synch.h don't change, so code
+ * built against them doesn't need to know which build it is linked
+ * with.
+ */
+#ifdef SYNCH_LEAN
+#undef KASSERT
+#define KASSERT(expr) ((void)sizeof(expr))
+#undef HANGMAN_WAIT
+#define HANGMAN_WAIT(a, l) ((void)0)
+#undef HANGMAN_ACQUIRE
+#define HANGMAN_ACQUIRE(a, l) ((void)0)
+#undef HANGMAN_RELEASE
+#define HANGMAN_RELEASE(a, l) ((void)0)
+#undef HANGMAN_LOCKABLEINIT
+#define HANGMAN_LOCKABLEINIT(l, n) ((void)0)
+#define SYNCH_NAMES 0
+#define SYNCH_STATS 0
+#else
+#define SYNCH_NAMES 1
+#define SYNCH_STATS 1
+#endif
+
+/*
+ * The instrumentation switch (see synch.h). Every hook tests it first,
+ * and only then anything else, so that while it is off that one test
+ * is all the hooks cost.
+ */
+static unsigned synch_instrumenting = 1;
+
+#define SYNCH_INSTRUMENTING() \
+	__builtin_expect(atomic_load(&synch_instrumenting) != 0, 0)
+
+static void synch_trace(unsigned event, const void *object, unsigned arg);
+static void synch_holdlog_record(struct lock *lock, uint64_t held);
+static uint64_t synch_now(void);
+static void barrier_spinadd(struct barrier *b, unsigned *acquires,
+			    unsigned *contended, uint64_t *rounds);
 
 ////////////////////////////////////////////////////////////
 //
-// Semaphore.
+// Ticket spinlocks.
 
-struct semaphore *
-sem_create(const char *name, unsigned initial_count)
+void
+ticketlock_init(struct ticketlock *tl)
 {
-	struct semaphore *sem;
+	tl->tl_next = 0;
+	tl->tl_serving = 0;
+	tl->tl_holder = NULL;
+	tl->tl_acquires = 0;
+	tl->tl_contended = 0;
+	tl->tl_rounds = 0;
+}
 
-	sem = kmalloc(sizeof(*sem));
-	if (sem == NULL) {
-		return NULL;
+void
+ticketlock_cleanup(struct ticketlock *tl)
+{
+	KASSERT(tl->tl_holder == NULL);
+	KASSERT(tl->tl_next == tl->tl_serving);
+}
+
+void
+ticketlock_acquire(struct ticketlock *tl)
+{
+	unsigned ticket, ahead, rounds, i;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	if (CURCPU_EXISTS() && tl->tl_holder == curcpu->c_self) {
+		panic("Deadlock on ticketlock %p\n", tl);
 	}
 
-	sem->sem_name = kstrdup(name);
-	if (sem->sem_name == NULL) {
-		kfree(sem);
-		return NULL;
+	ticket = atomic_fetch_add(&tl->tl_next, 1);
+	rounds = 0;
+	while ((ahead = ticket - atomic_load_acquire(&tl->tl_serving)) != 0) {
+		/*
+		 * Each CPU ahead of us will hold the lock for a while
+		 * yet, so don't look again until about then.
+		 */
+		for (i = 0; i < ahead * TICKETLOCK_BACKOFF; i++) {
+			atomic_pause();
+		}
+		rounds++;
 	}
 
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
+	if (CURCPU_EXISTS()) {
+		tl->tl_holder = curcpu->c_self;
+		curcpu->c_spinlocks++;
+	}
+	if (SYNCH_STATS && SYNCH_INSTRUMENTING()) {
+		tl->tl_acquires++;
+		if (rounds > 0) {
+			tl->tl_contended++;
+			tl->tl_rounds += rounds;
+		}
 	}
+}
 
-	spinlock_init(&sem->sem_lock);
-	sem->sem_count = initial_count;
+void
+ticketlock_release(struct ticketlock *tl)
+{
+	if (CURCPU_EXISTS()) {
+		KASSERT(tl->tl_holder == curcpu->c_self);
+		KASSERT(curcpu->c_spinlocks > 0);
+		curcpu->c_spinlocks--;
+	}
+	tl->tl_holder = NULL;
 
-	return sem;
+	/* Only the holder writes tl_serving. */
+	atomic_store_release(&tl->tl_serving, tl->tl_serving + 1);
+
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+bool
+ticketlock_do_i_hold(struct ticketlock *tl)
+{
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
+	return tl->tl_holder == curcpu->c_self;
 }
 
+////////////////////////////////////////////////////////////
+//
+// Wakeup placement.
+
+#define SYNCH_WAKE_MAXCPUS 32		/* higher CPUs share the last */
+
+static unsigned synch_wakeaffine;	/* only changed atomically */
+static unsigned (*synch_wake_where)(void);
+static void (*synch_wake_place)(struct thread *t, unsigned cpu);
+static struct synch_wakestats synch_wake_counts[SYNCH_WAKE_MAXCPUS];
+
 void
-sem_destroy(struct semaphore *sem)
+synch_wakeaffine_set(bool on)
 {
-	KASSERT(sem != NULL);
+	atomic_store(&synch_wakeaffine, on);
+}
 
-	/* wchan_cleanup will assert if anyone's waiting on it */
-	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
-	kfree(sem->sem_name);
-	kfree(sem);
+bool
+synch_wakeaffine_get(void)
+{
+	return atomic_load(&synch_wakeaffine) != 0;
 }
 
 void
-P(struct semaphore *sem)
+synch_wake_placer(unsigned (*where)(void),
+		  void (*place)(struct thread *t, unsigned cpu))
 {
-	KASSERT(sem != NULL);
+	synch_wake_where = where;
+	synch_wake_place = place;
+}
 
-	/*
-	 * May not block in an interrupt handler.
-	 *
-	 * For robustness, always check, even if we can actually
-	 * complete the P without blocking.
-	 */
-	KASSERT(curthread->t_in_interrupt == false);
+/*
+ * The CPU we're on, as the placer numbers them.
+ */
+static
+unsigned
+synch_wake_cpu(void)
+{
+	return synch_wake_where != NULL ? synch_wake_where() :
+		curcpu->c_number;
+}
 
-	/* Use the semaphore spinlock to protect the wchan as well. */
-	spinlock_acquire(&sem->sem_lock);
-	while (sem->sem_count == 0) {
-		/*
-		 *
-		 * Note that we don't maintain strict FIFO ordering of
-		 * threads going through the semaphore; that is, we
-		 * might "get" it on the first try even if other
-		 * threads are waiting. Apparently according to some
-		 * textbooks semaphores must for some reason have
-		 * strict ordering. Too bad. :-)
-		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
-		 */
-		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
+static
+struct synch_wakestats *
+synch_wake_mycounts(unsigned cpu)
+{
+	return &synch_wake_counts[cpu < SYNCH_WAKE_MAXCPUS ?
+				  cpu : SYNCH_WAKE_MAXCPUS - 1];
+}
+
+/*
+ * Waking a thread that went to sleep on CPU LAST SLEPT ns ago, from
+ * CPU WAKER: where it should run, per the heuristic in synch.h.
+ */
+static
+unsigned
+synch_wake_choose(unsigned last, uint64_t slept, unsigned waker)
+{
+	struct synch_wakestats *sw;
+	unsigned there;
+
+	there = last;
+	if (slept >= SYNCH_WAKE_HOTNS &&
+	    synch_cluster(last) != synch_cluster(waker)) {
+		there = waker;
 	}
-	KASSERT(sem->sem_count > 0);
-	sem->sem_count--;
-	spinlock_release(&sem->sem_lock);
+
+	if (SYNCH_STATS && SYNCH_INSTRUMENTING()) {
+		sw = synch_wake_mycounts(waker);
+		atomic_fetch_add(there == last ? &sw->sw_tolast :
+				 &sw->sw_towaker, 1);
+	}
+	return there;
 }
 
+/*
+ * Just woken, after going to sleep on CPU LAST: count where we ended
+ * up.
+ */
+static
 void
-V(struct semaphore *sem)
+synch_wake_arrive(unsigned last)
 {
-	KASSERT(sem != NULL);
+	struct synch_wakestats *sw;
+	unsigned here;
 
-	spinlock_acquire(&sem->sem_lock);
+	here = synch_wake_cpu();
+	sw = synch_wake_mycounts(here);
+	atomic_fetch_add(&sw->sw_wakeups, 1);
+	if (here != last) {
+		atomic_fetch_add(&sw->sw_migrated, 1);
+	}
+}
 
-	sem->sem_count++;
-	KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+void
+synch_wake_stats(struct synch_wakestats *sw)
+{
+	unsigned i;
 
-	spinlock_release(&sem->sem_lock);
+	bzero(sw, sizeof(*sw));
+	for (i = 0; i < SYNCH_WAKE_MAXCPUS; i++) {
+		sw->sw_wakeups += atomic_load(&synch_wake_counts[i].sw_wakeups);
+		sw->sw_migrated +=
+			atomic_load(&synch_wake_counts[i].sw_migrated);
+		sw->sw_tolast += atomic_load(&synch_wake_counts[i].sw_tolast);
+		sw->sw_towaker +=
+			atomic_load(&synch_wake_counts[i].sw_towaker);
+	}
 }
 
 ////////////////////////////////////////////////////////////
 //
-// Lock.
+// Wait table.
 
-struct lock *
-lock_create(const char *name)
-{
-        struct lock *lock;
+/*
+ * Sync objects don't have wait channels of their own. Threads sleep
+ * in one global table of wait channels instead, hashed by the address
+ * of whatever they're waiting on (the "key"). Keys that hash to the
+ * same bucket share its spinlock and wchan; as long as all sleepers in
+ * a bucket have the same key a wakeup only wakes as many as it has
+ * to, and once keys are mixed it wakes them all and lets each one
+ * check its own condition.
+ *
+ * The object's own state stays under its own spinlock. To sleep, a
+ * thread counts itself as a waiter under that spinlock and calls
+ * waittable_wait, which checks the condition again under the bucket
+ * lock before sleeping. Whoever changes the state so that a counted
+ * waiter might get going must then call waittable_wake. The wakeup
+ * takes the bucket lock after the state has changed, so the waiter has
+ * either seen the change or is already asleep when it comes.
+ *
+ * Each sleeper also puts a record of itself on the bucket's own queue,
+ * which waittable_wake takes sleepers off in the same order as the
+ * wchan wakes them (both are FIFO), so that it knows which threads it
+ * is waking. It chooses where those sleeping on its key should run
+ * (above) under the bucket lock, and has the placer put them there
+ * once it has let go of the lock; they wait for that before leaving
+ * waittable_wait, which keeps their records and themselves around.
+ */
+#define WAITTABLE_SIZE 64	/* must be a power of 2 */
 
-        lock = kmalloc(sizeof(*lock));
-        if (lock == NULL) {
-                return NULL;
-        }
+struct waitrecord {
+	struct waitrecord *wr_next;
+	const void *wr_key;
+	struct thread *wr_thread;
+	unsigned wr_cpu;		/* CPU it went to sleep on */
+	uint64_t wr_since;		/* when, if affine */
+	unsigned wr_there;		/* CPU the waker chose */
+	unsigned wr_placing;		/* waker still placing us; atomic */
+	struct waitrecord *wr_placed;	/* waker's list of them */
+};
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
-                return NULL;
-        }
+struct waitbucket {
+	struct spinlock wb_lock;
+	struct wchan *wb_wchan;
+	const void *wb_key;		/* key of every sleeper, unless mixed */
+	unsigned wb_sleepers;
+	bool wb_mixed;			/* sleepers have different keys */
+	struct waitrecord *wb_head;	/* sleepers, in wchan order */
+	struct waitrecord *wb_tail;
+};
 
-	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
-	
-	//the inital state of the holding thread must be NULL
-	//because its value is used to check if the lock is 
-	//available
-	lock->holding_thread = NULL;
-	
-	//initialize the lock's internal spinlock
-	spinlock_init(&lock->lock_lock);
-	
-	//create the waiting channel for the lock
-	lock->lock_wchan = wchan_create(lock->lk_name);
-	
-	//if the waiting channel is unable to be created
-	//the function will deallocate the lock and return NULL 
-	if(lock->lock_wchan==NULL){
-     	spinlock_cleanup(&lock->lock_lock);
-	kfree(lock->lk_name);
-     	kfree(lock);
-     	return NULL;
-	}
-	
-	return lock;
-}
+static struct waitbucket waittable[WAITTABLE_SIZE];
 
-void
-lock_destroy(struct lock *lock)
+static
+struct waitbucket *
+waittable_bucket(const void *key)
 {
-        KASSERT(lock != NULL);
-	//Deallocate the spinlock, waiting channel, the
-	//lock and its name
-	spinlock_cleanup(&lock->lock_lock);
-	wchan_destroy(lock->lock_wchan);
-        kfree(lock->lk_name);
-        kfree(lock);
+	uintptr_t k = (uintptr_t)key;
+
+	/* Keys are at least word aligned; fold in some higher bits. */
+	k = (k >> 3) ^ (k >> 9);
+	return &waittable[k & (WAITTABLE_SIZE - 1)];
 }
 
+/*
+ * Sleep on KEY for as long as BLOCKED(ARG) says to. If LK is not NULL
+ * it is held on entry, released while waiting, and held again on
+ * return. BLOCKED is called without LK, so the caller has to check
+ * the real condition again afterwards; it is called with the bucket
+ * lock held, though, which is what keeps it from reading state older
+ * than the last wakeup.
+ */
+static
 void
-lock_acquire(struct lock *lock)
+waittable_wait(const void *key, struct ticketlock *lk,
+	       bool (*blocked)(void *), void *arg)
 {
-        //Ensure that the lock being passed in exists
-	KASSERT(lock != NULL);
-        
-	//Check that the calling thread is not being interrupted
-	KASSERT(curthread->t_in_interrupt == false);
-	
-	//Ensure that the calling thread does not already hold the lock
-	KASSERT(!lock_do_i_hold(lock));
-	
+	struct waitbucket *wb = waittable_bucket(key);
+	struct waitrecord wr;
+	bool counting, woke = false;
 
-	//surround the lock-aquire code with a spinlock to avoid
-	//multiple threads trying to access the lock at once
-	spinlock_acquire(&lock->lock_lock);
+	KASSERT(wb->wb_wchan != NULL);
 
-	//Make the following section atomic by setting the Priority
-	//Level to its highest
-	int spl = splhigh();
-	
-	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	counting = SYNCH_STATS && SYNCH_INSTRUMENTING();
+	wr.wr_key = key;
+	wr.wr_thread = curthread;
+	wr.wr_cpu = 0;
+	wr.wr_since = 0;
+	wr.wr_placing = 0;
 
+	if (lk != NULL) {
+		ticketlock_release(lk);
+	}
 
-        // When a thread reaches this point, if there is another thread holding the lock
-        // (the lock's holding_thread pointer is not NULL) then they will be added to the
-        // waiting channel.
-	while(lock->holding_thread != NULL)
-	{
-	wchan_sleep(lock->lock_wchan, &lock->lock_lock);
+	spinlock_acquire(&wb->wb_lock);
+	while (blocked(arg)) {
+		if (wb->wb_sleepers == 0) {
+			wb->wb_key = key;
+		}
+		else if (wb->wb_key != key) {
+			wb->wb_mixed = true;
+		}
+		wb->wb_sleepers++;
+		if (counting || synch_wake_place != NULL) {
+			wr.wr_cpu = synch_wake_cpu();
+		}
+		if (synch_wake_place != NULL &&
+		    atomic_load(&synch_wakeaffine) != 0) {
+			wr.wr_since = synch_now();
+		}
+		/* The waker takes it off again. */
+		wr.wr_next = NULL;
+		if (wb->wb_tail == NULL) {
+			wb->wb_head = &wr;
+		}
+		else {
+			wb->wb_tail->wr_next = &wr;
+		}
+		wb->wb_tail = &wr;
+		synch_trace(SYNCH_TR_SLEEP, key, 0);
+		wchan_sleep(wb->wb_wchan, &wb->wb_lock);
+		synch_trace(SYNCH_TR_WAKEUP, key, 0);
+		if (atomic_load(&wr.wr_placing) != 0) {
+			/* Not long: the waker is running, with no locks. */
+			spinlock_release(&wb->wb_lock);
+			while (atomic_load_acquire(&wr.wr_placing) != 0) {
+				atomic_pause();
+			}
+			spinlock_acquire(&wb->wb_lock);
+		}
+		woke = true;
+		wb->wb_sleepers--;
+		if (wb->wb_sleepers == 0) {
+			wb->wb_mixed = false;
+		}
 	}
-	
-	//the current thread will aquire the lock
-	lock->holding_thread = curthread;
-	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
-	
+	spinlock_release(&wb->wb_lock);
 
-	//Restore the Priority Level to the level it was at before the 
-	//call
-	splx(spl);
-	
-	spinlock_release(&lock->lock_lock);
+	if (woke && counting) {
+		synch_wake_arrive(wr.wr_cpu);
+	}
 
+	if (lk != NULL) {
+		ticketlock_acquire(lk);
+	}
 }
+
+/*
+ * Take the first sleeper's record off WB's queue, for a wakeup on KEY;
+ * the wchan wakeup that goes with it comes next. If PLACING and it was
+ * sleeping on KEY, choose where it goes and add it to *PLACED.
+ */
+static
 void
-lock_release(struct lock *lock)
+waittable_dequeue(struct waitbucket *wb, const void *key, bool placing,
+		  unsigned waker, uint64_t now, struct waitrecord **placed)
 {
+	struct waitrecord *wr = wb->wb_head;
 
-        //Ensure that the lock being passed in exists
-	KASSERT(lock != NULL);
-	
-	//ensure that the calling thread has the lock
-	KASSERT(lock->holding_thread == curthread);
-
-	//use a spinlock to ensure multiple threads do not try to release the
-	//lock at the same time (potentially waking up multiple threads)
-	spinlock_acquire(&lock->lock_lock);
-	
+	KASSERT(wr != NULL);
+	wb->wb_head = wr->wr_next;
+	if (wb->wb_head == NULL) {
+		wb->wb_tail = NULL;
+	}
+	if (placing && wr->wr_key == key) {
+		wr->wr_there = synch_wake_choose(wr->wr_cpu,
+						 now - wr->wr_since, waker);
+		wr->wr_placing = 1;
+		wr->wr_placed = *placed;
+		*placed = wr;
+	}
+}
 
-	//Make the following section atomic by setting the Priority
-        //Level to its highest
-	int spl = splhigh();
+/*
+ * Wake one thread, or all of them, sleeping on KEY.
+ */
+static
+void
+waittable_wake(const void *key, bool all)
+{
+	struct waitbucket *wb = waittable_bucket(key);
+	struct waitrecord *placed = NULL, *wr;
+	unsigned waker = 0;
+	uint64_t now = 0;
+	bool placing;
 
-	//The lock is released
-	lock->holding_thread = NULL;
+	placing = synch_wake_place != NULL &&
+		atomic_load(&synch_wakeaffine) != 0;
 
-	//release a thread from the waiting channel
-	wchan_wakeone(lock->lock_wchan, &lock->lock_lock);
+	spinlock_acquire(&wb->wb_lock);
+	if (wb->wb_sleepers > 0) {
+		synch_trace(SYNCH_TR_WAKE, key, all);
+		if (placing) {
+			waker = synch_wake_cpu();
+			now = synch_now();
+		}
+		if (all || wb->wb_mixed) {
+			while (wb->wb_head != NULL) {
+				waittable_dequeue(wb, key, placing, waker,
+						  now, &placed);
+			}
+			wchan_wakeall(wb->wb_wchan, &wb->wb_lock);
+		}
+		else if (wb->wb_key == key && wb->wb_head != NULL) {
+			waittable_dequeue(wb, key, placing, waker, now,
+					  &placed);
+			wchan_wakeone(wb->wb_wchan, &wb->wb_lock);
+		}
+	}
+	spinlock_release(&wb->wb_lock);
 
-	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
-        
-	//Restore the Priority Level to the level it was at before the 
-        //call
-	splx(spl);
-	
-	spinlock_release(&lock->lock_lock);
-		
+	/* Once we let go of each, it may return and its record go away. */
+	while (placed != NULL) {
+		wr = placed;
+		placed = wr->wr_placed;
+		synch_wake_place(wr->wr_thread, wr->wr_there);
+		atomic_store_release(&wr->wr_placing, 0);
+	}
 }
 
-bool
-lock_do_i_hold(struct lock *lock)
+static
+void
+waittable_bootstrap(void)
 {
-	//returns true when the calling thread 
-	//holds the lock
-        KASSERT(lock != NULL);
-	
-	return (lock->holding_thread == curthread);
-}
+	unsigned i;
 
+	for (i = 0; i < WAITTABLE_SIZE; i++) {
+		spinlock_init(&waittable[i].wb_lock);
+		waittable[i].wb_wchan = wchan_create("waittable");
+		if (waittable[i].wb_wchan == NULL) {
+			panic("waittable_bootstrap: Out of memory\n");
+		}
+		waittable[i].wb_key = NULL;
+		waittable[i].wb_sleepers = 0;
+		waittable[i].wb_mixed = false;
+		waittable[i].wb_head = NULL;
+		waittable[i].wb_tail = NULL;
+	}
+}
 
 ////////////////////////////////////////////////////////////
 //
-// CV
+// Statistics.
 
+/*
+ * The time, in nanoseconds, for measuring waits and hold times.
+ */
+static
+uint64_t
+synch_now(void)
+{
+	struct timespec ts;
 
-struct cv *
-cv_create(const char *name)
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * The time to start measuring a wait from; always 0, which means "no
+ * wait", if there are no statistics.
+ */
+static
+uint64_t
+synch_stamp(void)
 {
-	struct cv *cv;
+	return SYNCH_STATS && SYNCH_INSTRUMENTING() ? synch_now() : 0;
+}
 
-	cv = kmalloc(sizeof(*cv));
-	if (cv == NULL) {
-		return NULL;
+/*
+ * Copies of object names, for debugging. The lean build names
+ * everything "".
+ */
+static char synch_noname[] = "";
+
+static
+char *
+synch_namedup(const char *name)
+{
+	if (!SYNCH_NAMES) {
+		(void)name;
+		return synch_noname;
 	}
+	return kstrdup(name);
+}
 
-	cv->cv_name = kstrdup(name);
-	if (cv->cv_name==NULL) {
-		kfree(cv);
-		return NULL;
+static
+void
+synch_namefree(char *name)
+{
+	if (name != synch_noname) {
+		kfree(name);
 	}
+}
 
-	// add stuff here as needed
+void
+synch_instrument_set(bool on)
+{
+	atomic_store(&synch_instrumenting, on);
+}
 
-	return cv;
+bool
+synch_instrument_get(void)
+{
+	return atomic_load(&synch_instrumenting) != 0;
 }
 
-void
-cv_destroy(struct cv *cv)
+static
+unsigned
+synch_hist_bucket(uint64_t ns)
 {
-	KASSERT(cv != NULL);
+	unsigned bits;
+
+	if (ns < SYNCH_HIST_SUB) {
+		return ns;
+	}
+	bits = 63 - __builtin_clzll(ns);	/* highest bit set */
+	if (bits >= SYNCH_HIST_MAXBITS) {
+		return SYNCH_HIST_BUCKETS - 1;
+	}
+	return (bits - SYNCH_HIST_SUBBITS + 1) * SYNCH_HIST_SUB +
+		((ns >> (bits - SYNCH_HIST_SUBBITS)) & (SYNCH_HIST_SUB - 1));
+}
 
-	// add stuff here as needed
+/*
+ * The largest value that goes into bucket B.
+ */
+static
+uint64_t
+synch_hist_top(unsigned b)
+{
+	unsigned shift;
 
-	kfree(cv->cv_name);
-	kfree(cv);
+	if (b < SYNCH_HIST_SUB) {
+		return b;
+	}
+	shift = b / SYNCH_HIST_SUB - 1;
+	return (((uint64_t)SYNCH_HIST_SUB + b % SYNCH_HIST_SUB + 1) << shift)
+		- 1;
 }
 
 void
-cv_wait(struct cv *cv, struct lock *lock)
+synch_hist_record(struct synch_hist *sh, uint64_t ns)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	sh->sh_count[synch_hist_bucket(ns)]++;
 }
 
 void
-cv_signal(struct cv *cv, struct lock *lock)
+synch_hist_merge(struct synch_hist *dst, const struct synch_hist *src)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	unsigned b;
+
+	for (b = 0; b < SYNCH_HIST_BUCKETS; b++) {
+		dst->sh_count[b] += src->sh_count[b];
+	}
 }
 
-void
-cv_broadcast(struct cv *cv, struct lock *lock)
+uint64_t
+synch_hist_total(const struct synch_hist *sh)
+{
+	uint64_t total = 0;
+	unsigned b;
+
+	for (b = 0; b < SYNCH_HIST_BUCKETS; b++) {
+		total += sh->sh_count[b];
+	}
+	return total;
+}
+
+uint64_t
+synch_hist_percentile(const struct synch_hist *sh, unsigned permille)
 {
-	// Write this
-	(void)cv;    // suppress warning until code gets written
-	(void)lock;  // suppress warning until code gets written
+	uint64_t want, seen;
+	unsigned b;
+
+	KASSERT(permille <= 1000);
+
+	want = (synch_hist_total(sh) * permille + 999) / 1000;
+	if (want == 0) {
+		return 0;
+	}
+	seen = 0;
+	for (b = 0; b < SYNCH_HIST_BUCKETS; b++) {
+		seen += sh->sh_count[b];
+		if (seen >= want) {
+			break;
+		}
+	}
+	return synch_hist_top(b);
+}
+
+/*
+ * All existing semaphores, locks and CVs.
+ */
+static struct spinlock synch_stats_lock = SPINLOCK_INITIALIZER;
+static struct synch_stats *synch_stats_list;
+
+/*
+ * One line of synch_stats_print's report, merged under synch_stats_lock
+ * and printed after letting go of it.
+ */
+struct synch_stats_report {
+	char sr_name[32];		/* cut short */
+	unsigned sr_kind;
+	unsigned sr_n;			/* objects merged */
+	bool sr_haswait, sr_hashold, sr_hasspin;
+	struct synch_hist sr_wait, sr_hold;
+	unsigned sr_acquires, sr_contended;
+	uint64_t sr_rounds;
+	unsigned sr_local, sr_remote;	/* cohort handoffs */
+};
+
+/*
+ * Lock hold limits by name, also under synch_stats_lock. Each lock
+ * gets a copy of its limit in ss_holdlimit, so that lock_release
+ * doesn't have to look it up.
+ */
+struct synch_holdlimit {
+	char *hl_name;			/* NULL if the slot is free */
+	unsigned hl_us;
+};
+
+static struct synch_holdlimit synch_holdlimits[SYNCH_HOLDLIMIT_MAX];
+
+/*
+ * The hold limit for locks named NAME. Call with synch_stats_lock
+ * held.
+ */
+static
+unsigned
+synch_holdlimit_find(const char *name)
+{
+	unsigned i;
+
+	for (i = 0; i < SYNCH_HOLDLIMIT_MAX; i++) {
+		if (synch_holdlimits[i].hl_name != NULL &&
+		    !strcmp(synch_holdlimits[i].hl_name, name)) {
+			return synch_holdlimits[i].hl_us;
+		}
+	}
+	return 0;
+}
+
+static
+void
+synch_stats_init(struct synch_stats *ss, unsigned kind, void *object,
+		 const char *name, struct synch_hist *wait,
+		 struct synch_hist *hold, struct ticketlock *spin)
+{
+	ss->ss_object = object;
+	ss->ss_name = name;
+	ss->ss_kind = kind;
+	ss->ss_wait = wait;
+	ss->ss_hold = hold;
+	ss->ss_spin = spin;
+	ss->ss_holdlimit = 0;
+	if (!SYNCH_STATS) {
+		/* Not on the list, so never looked at. */
+		return;
+	}
+	if (wait != NULL) {
+		bzero(wait, sizeof(*wait));
+	}
+	if (hold != NULL) {
+		bzero(hold, sizeof(*hold));
+	}
+
+	spinlock_acquire(&synch_stats_lock);
+	ss->ss_holdlimit = kind == SYNCH_KIND_LOCK ?
+		synch_holdlimit_find(name) : 0;
+	ss->ss_prev = NULL;
+	ss->ss_next = synch_stats_list;
+	if (synch_stats_list != NULL) {
+		synch_stats_list->ss_prev = ss;
+	}
+	synch_stats_list = ss;
+	spinlock_release(&synch_stats_lock);
+}
+
+static
+void
+synch_stats_cleanup(struct synch_stats *ss)
+{
+	if (!SYNCH_STATS) {
+		return;
+	}
+	spinlock_acquire(&synch_stats_lock);
+	if (ss->ss_prev != NULL) {
+		ss->ss_prev->ss_next = ss->ss_next;
+	}
+	else {
+		synch_stats_list = ss->ss_next;
+	}
+	if (ss->ss_next != NULL) {
+		ss->ss_next->ss_prev = ss->ss_prev;
+	}
+	spinlock_release(&synch_stats_lock);
+}
+
+/*
+ * The merge itself; call with synch_stats_lock held.
+ */
+static
+unsigned
+synch_stats_domerge(unsigned kind, const char *name,
+		    struct synch_hist *wait, struct synch_hist *hold)
+{
+	struct synch_stats *ss;
+	unsigned n = 0;
+
+	for (ss = synch_stats_list; ss != NULL; ss = ss->ss_next) {
+		if (ss->ss_kind != kind || strcmp(ss->ss_name, name)) {
+			continue;
+		}
+		if (ss->ss_wait != NULL) {
+			synch_hist_merge(wait, ss->ss_wait);
+		}
+		if (hold != NULL && ss->ss_hold != NULL) {
+			synch_hist_merge(hold, ss->ss_hold);
+		}
+		n++;
+	}
+	return n;
+}
+
+unsigned
+synch_stats_merge(unsigned kind, const char *name,
+		  struct synch_hist *wait, struct synch_hist *hold)
+{
+	unsigned n;
+
+	spinlock_acquire(&synch_stats_lock);
+	n = synch_stats_domerge(kind, name, wait, hold);
+	spinlock_release(&synch_stats_lock);
+	return n;
+}
+
+static
+void
+synch_stats_printhist(const char *what, const struct synch_hist *sh)
+{
+	kprintf("    %s: %llu, p50 %llu p99 %llu p999 %llu ns\n", what,
+		(unsigned long long)synch_hist_total(sh),
+		(unsigned long long)synch_hist_percentile(sh, 500),
+		(unsigned long long)synch_hist_percentile(sh, 990),
+		(unsigned long long)synch_hist_percentile(sh, 999));
+}
+
+/*
+ * Add TL's counters to the totals. They are read without the lock, so
+ * they may be a little behind.
+ */
+static
+void
+synch_stats_spinadd(struct ticketlock *tl, unsigned *acquires,
+		    unsigned *contended, uint64_t *rounds)
+{
+	*acquires += tl->tl_acquires;
+	*contended += tl->tl_contended;
+	*rounds += tl->tl_rounds;
+}
+
+/*
+ * Add up the internal lock counters of every object of KIND named
+ * NAME; call with synch_stats_lock held.
+ */
+static
+void
+synch_stats_spinmerge(unsigned kind, const char *name, unsigned *acquires,
+		      unsigned *contended, uint64_t *rounds)
+{
+	struct synch_stats *ss;
+
+	*acquires = *contended = 0;
+	*rounds = 0;
+	for (ss = synch_stats_list; ss != NULL; ss = ss->ss_next) {
+		if (ss->ss_kind != kind || ss->ss_spin == NULL ||
+		    strcmp(ss->ss_name, name)) {
+			continue;
+		}
+		synch_stats_spinadd(ss->ss_spin, acquires, contended, rounds);
+		if (kind == SYNCH_KIND_BARRIER) {
+			barrier_spinadd(ss->ss_object, acquires, contended,
+					rounds);
+		}
+	}
+}
+
+/*
+ * Add up the handoff counts of every cohort lock named NAME; call with
+ * synch_stats_lock held.
+ */
+static
+void
+synch_stats_handoffmerge(const char *name, unsigned *local,
+			 unsigned *remote)
+{
+	struct synch_stats *ss;
+
+	*local = *remote = 0;
+	for (ss = synch_stats_list; ss != NULL; ss = ss->ss_next) {
+		if (ss->ss_kind == SYNCH_KIND_COHORT &&
+		    !strcmp(ss->ss_name, name)) {
+			cohortlock_handoffs(ss->ss_object, local, remote);
+		}
+	}
+}
+
+/*
+ * Find the Kth object that is the first with its kind and name; call
+ * with synch_stats_lock held.
+ */
+static
+struct synch_stats *
+synch_stats_nthname(unsigned k)
+{
+	struct synch_stats *ss, *prev;
+
+	for (ss = synch_stats_list; ss != NULL; ss = ss->ss_next) {
+		for (prev = synch_stats_list; prev != ss;
+		     prev = prev->ss_next) {
+			if (prev->ss_kind == ss->ss_kind &&
+			    !strcmp(prev->ss_name, ss->ss_name)) {
+				break;
+			}
+		}
+		if (prev == ss && k-- == 0) {
+			return ss;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Merge one name at a time into SR under synch_stats_lock and print
+ * it after letting go. Objects can come and go between names, so a
+ * name may be skipped or shown twice if the list changes meanwhile.
+ */
+void
+synch_stats_print(void)
+{
+	static const char *const kinds[] = {
+		"sem", "lock", "cv", "rwlock", "seqlock", "barrier",
+		"cohort", "shardsem",
+	};
+	struct synch_stats_report *sr;
+	struct synch_stats *ss;
+	struct synch_wakestats sw;
+	unsigned k;
+
+	sr = kmalloc(sizeof(*sr));
+	if (sr == NULL) {
+		kprintf("synch_stats_print: out of memory\n");
+		return;
+	}
+
+	for (k = 0; ; k++) {
+		spinlock_acquire(&synch_stats_lock);
+		ss = synch_stats_nthname(k);
+		if (ss == NULL) {
+			spinlock_release(&synch_stats_lock);
+			break;
+		}
+		snprintf(sr->sr_name, sizeof(sr->sr_name), "%s", ss->ss_name);
+		sr->sr_kind = ss->ss_kind;
+		sr->sr_haswait = ss->ss_wait != NULL;
+		sr->sr_hashold = ss->ss_hold != NULL;
+		sr->sr_hasspin = ss->ss_spin != NULL;
+		bzero(&sr->sr_wait, sizeof(sr->sr_wait));
+		bzero(&sr->sr_hold, sizeof(sr->sr_hold));
+		sr->sr_n = synch_stats_domerge(ss->ss_kind, ss->ss_name,
+					       &sr->sr_wait, &sr->sr_hold);
+		if (sr->sr_hasspin) {
+			synch_stats_spinmerge(ss->ss_kind, ss->ss_name,
+					      &sr->sr_acquires,
+					      &sr->sr_contended,
+					      &sr->sr_rounds);
+		}
+		if (ss->ss_kind == SYNCH_KIND_COHORT) {
+			synch_stats_handoffmerge(ss->ss_name, &sr->sr_local,
+						 &sr->sr_remote);
+		}
+		spinlock_release(&synch_stats_lock);
+
+		kprintf("%s %s (%u)\n", kinds[sr->sr_kind], sr->sr_name,
+			sr->sr_n);
+		if (sr->sr_haswait) {
+			synch_stats_printhist("wait", &sr->sr_wait);
+		}
+		if (sr->sr_hashold) {
+			synch_stats_printhist("hold", &sr->sr_hold);
+		}
+		if (sr->sr_hasspin) {
+			kprintf("    internal lock: %u, contended %u, "
+				"backoff rounds %llu\n", sr->sr_acquires,
+				sr->sr_contended,
+				(unsigned long long)sr->sr_rounds);
+		}
+		if (sr->sr_kind == SYNCH_KIND_COHORT) {
+			kprintf("    handoffs: in cluster %u, to another "
+				"cluster %u\n", sr->sr_local, sr->sr_remote);
+		}
+	}
+	kfree(sr);
+
+	synch_wake_stats(&sw);
+	kprintf("wakeups: %u, migrated %u, placed back %u, on waker %u\n",
+		sw.sw_wakeups, sw.sw_migrated, sw.sw_tolast, sw.sw_towaker);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Tracing.
+
+#define SYNCH_TRACE_MAXCPUS 32
+
+/*
+ * One CPU's ring. Only that CPU writes it, with interrupts off (inside
+ * rcu_read_lock), so tr_head needs no lock; synch_trace_stop waits
+ * for an RCU grace period, after which nobody is writing.
+ */
+struct synch_trace_ring {
+	unsigned tr_head;		/* records written, ever */
+	struct synch_trace_rec *tr_recs;
+};
+
+static unsigned synch_tracing;		/* only changed atomically */
+static unsigned synch_trace_nrecs;	/* ring size */
+static struct synch_trace_ring synch_trace_rings[SYNCH_TRACE_MAXCPUS];
+
+static
+void
+synch_trace(unsigned event, const void *object, unsigned arg)
+{
+	struct synch_trace_ring *ring;
+	struct synch_trace_rec *tr;
+	unsigned cpu;
+
+	if (!SYNCH_INSTRUMENTING() || atomic_load(&synch_tracing) == 0) {
+		return;
+	}
+
+	rcu_read_lock();
+	cpu = curcpu->c_number;
+	/* Check again now that synch_trace_stop has to wait for us. */
+	if (atomic_load_acquire(&synch_tracing) != 0 &&
+	    cpu < SYNCH_TRACE_MAXCPUS) {
+		ring = &synch_trace_rings[cpu];
+		tr = &ring->tr_recs[ring->tr_head % synch_trace_nrecs];
+		tr->tr_time = synch_now();
+		tr->tr_object = (uint32_t)(uintptr_t)object;
+		tr->tr_thread = (uint32_t)(uintptr_t)curthread;
+		tr->tr_cpu = cpu;
+		tr->tr_event = event;
+		tr->tr_arg = arg;
+		ring->tr_head++;
+	}
+	rcu_read_unlock();
+}
+
+static
+void
+synch_trace_free(void)
+{
+	unsigned i;
+
+	for (i = 0; i < SYNCH_TRACE_MAXCPUS; i++) {
+		kfree(synch_trace_rings[i].tr_recs);
+		synch_trace_rings[i].tr_recs = NULL;
+		synch_trace_rings[i].tr_head = 0;
+	}
+	synch_trace_nrecs = 0;
+}
+
+int
+synch_trace_start(unsigned nrecs)
+{
+	unsigned i;
+
+	KASSERT(nrecs > 0);
+
+	synch_trace_stop();
+	synch_trace_free();
+
+	for (i = 0; i < SYNCH_TRACE_MAXCPUS; i++) {
+		synch_trace_rings[i].tr_recs =
+			kmalloc(nrecs * sizeof(struct synch_trace_rec));
+		if (synch_trace_rings[i].tr_recs == NULL) {
+			synch_trace_free();
+			return ENOMEM;
+		}
+	}
+	synch_trace_nrecs = nrecs;
+
+	atomic_store_release(&synch_tracing, 1);
+	return 0;
+}
+
+void
+synch_trace_stop(void)
+{
+	if (atomic_exchange(&synch_tracing, 0) != 0) {
+		synchronize_rcu();
+	}
+}
+
+/*
+ * Write LEN bytes at BUF to VN at *POS, and advance *POS.
+ */
+static
+int
+synch_trace_write(struct vnode *vn, const void *buf, size_t len, off_t *pos)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	uio_kinit(&iov, &u, (void *)buf, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return ENOSPC;
+	}
+	*pos += len;
+	return 0;
+}
+
+int
+synch_trace_dump(const char *path)
+{
+	struct synch_trace_header sth;
+	struct synch_trace_ring *ring;
+	struct vnode *vn;
+	char *pathcopy;
+	off_t pos = 0;
+	unsigned i, kept, first;
+	int result;
+
+	synch_trace_stop();
+
+	sth.sth_magic = SYNCH_TRACE_MAGIC;
+	sth.sth_version = SYNCH_TRACE_VERSION;
+	sth.sth_recsize = sizeof(struct synch_trace_rec);
+	sth.sth_nrecs = 0;
+	sth.sth_dropped = 0;
+	for (i = 0; i < SYNCH_TRACE_MAXCPUS; i++) {
+		ring = &synch_trace_rings[i];
+		kept = ring->tr_head < synch_trace_nrecs ?
+			ring->tr_head : synch_trace_nrecs;
+		sth.sth_nrecs += kept;
+		sth.sth_dropped += ring->tr_head - kept;
+	}
+
+	/* vfs_open may scribble on the path. */
+	pathcopy = kstrdup(path);
+	if (pathcopy == NULL) {
+		return ENOMEM;
+	}
+	result = vfs_open(pathcopy, O_WRONLY | O_CREAT | O_TRUNC, 0664, &vn);
+	kfree(pathcopy);
+	if (result) {
+		return result;
+	}
+
+	result = synch_trace_write(vn, &sth, sizeof(sth), &pos);
+
+	/* Oldest first: from the head to the end, then from the start. */
+	for (i = 0; i < SYNCH_TRACE_MAXCPUS && !result; i++) {
+		ring = &synch_trace_rings[i];
+		if (ring->tr_head == 0) {
+			continue;
+		}
+		if (ring->tr_head <= synch_trace_nrecs) {
+			result = synch_trace_write(vn, ring->tr_recs,
+				ring->tr_head * sizeof(struct synch_trace_rec),
+				&pos);
+			continue;
+		}
+		first = ring->tr_head % synch_trace_nrecs;
+		result = synch_trace_write(vn, &ring->tr_recs[first],
+			(synch_trace_nrecs - first) *
+			sizeof(struct synch_trace_rec), &pos);
+		if (!result && first > 0) {
+			result = synch_trace_write(vn, ring->tr_recs,
+				first * sizeof(struct synch_trace_rec), &pos);
+		}
+	}
+
+	vfs_close(vn);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Contention call sites.
+
+struct synch_callsite {
+	const void *cs_object;		/* NULL if the slot is free */
+	const void *cs_site;		/* return address of the acquire */
+	unsigned cs_kind;		/* SYNCH_KIND_* */
+	char cs_name[16];		/* the object's name, cut short */
+	unsigned cs_count;		/* contended acquisitions */
+	uint64_t cs_waitns;		/* total time waited */
+};
+
+static struct spinlock synch_callsite_lock = SPINLOCK_INITIALIZER;
+static struct synch_callsite synch_callsites[SYNCH_CALLSITE_SIZE];
+static unsigned synch_callsite_dropped;
+
+/* Copy of the table for synch_callsite_print to sort and print. */
+static struct synch_callsite synch_callsite_copy[SYNCH_CALLSITE_SIZE];
+
+/*
+ * Home slot for (OBJECT, SITE): Fibonacci hashing, taking the top bits
+ * of the product, which are the well-mixed ones.
+ */
+static
+unsigned
+synch_callsite_slot(const void *object, const void *site)
+{
+	uint32_t h;
+
+	h = (uint32_t)(((uintptr_t)object >> 4) ^ (uintptr_t)site);
+	h *= 2654435761U;
+	return (h >> 16) & (SYNCH_CALLSITE_SIZE - 1);
+}
+
+/*
+ * Charge SITE with one contended acquisition of OBJECT that waited NS.
+ * Only called after waiting, so the lock is never on a fast path.
+ */
+static
+void
+synch_callsite_record(unsigned kind, const void *object, const char *name,
+		      const void *site, uint64_t ns)
+{
+	struct synch_callsite *cs;
+	unsigned i, n;
+
+	i = synch_callsite_slot(object, site);
+
+	spinlock_acquire(&synch_callsite_lock);
+	/* Open addressing with linear probing; slots are never freed. */
+	for (n = 0; n < SYNCH_CALLSITE_SIZE; n++) {
+		cs = &synch_callsites[(i + n) & (SYNCH_CALLSITE_SIZE - 1)];
+		if (cs->cs_object == NULL) {
+			cs->cs_object = object;
+			cs->cs_site = site;
+			cs->cs_kind = kind;
+			snprintf(cs->cs_name, sizeof(cs->cs_name), "%s", name);
+		}
+		if (cs->cs_object == object && cs->cs_site == site) {
+			cs->cs_count++;
+			cs->cs_waitns += ns;
+			spinlock_release(&synch_callsite_lock);
+			return;
+		}
+	}
+	synch_callsite_dropped++;
+	spinlock_release(&synch_callsite_lock);
+}
+
+void
+synch_callsite_print(void)
+{
+	static const char *const kinds[] = { "sem", "lock", "cv", "rwlock" };
+	struct synch_callsite *cs, tmp;
+	unsigned i, j, n, dropped;
+
+	spinlock_acquire(&synch_callsite_lock);
+	n = 0;
+	for (i = 0; i < SYNCH_CALLSITE_SIZE; i++) {
+		if (synch_callsites[i].cs_object != NULL) {
+			synch_callsite_copy[n++] = synch_callsites[i];
+		}
+	}
+	dropped = synch_callsite_dropped;
+	spinlock_release(&synch_callsite_lock);
+
+	/* Insertion sort, most total wait first. */
+	for (i = 1; i < n; i++) {
+		tmp = synch_callsite_copy[i];
+		for (j = i; j > 0; j--) {
+			if (synch_callsite_copy[j - 1].cs_waitns >=
+			    tmp.cs_waitns) {
+				break;
+			}
+			synch_callsite_copy[j] = synch_callsite_copy[j - 1];
+		}
+		synch_callsite_copy[j] = tmp;
+	}
+
+	for (i = 0; i < n; i++) {
+		cs = &synch_callsite_copy[i];
+		kprintf("%s %s %p from %p: %u waits, %llu ns total, "
+			"%llu ns avg\n", kinds[cs->cs_kind], cs->cs_name,
+			cs->cs_object, cs->cs_site, cs->cs_count,
+			(unsigned long long)cs->cs_waitns,
+			(unsigned long long)(cs->cs_waitns / cs->cs_count));
+	}
+	if (dropped > 0) {
+		kprintf("%u contended acquisitions dropped (table full)\n",
+			dropped);
+	}
+}
+
+void
+synch_callsite_reset(void)
+{
+	spinlock_acquire(&synch_callsite_lock);
+	bzero(synch_callsites, sizeof(synch_callsites));
+	synch_callsite_dropped = 0;
+	spinlock_release(&synch_callsite_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Semaphore.
+
+struct semaphore *
+sem_create(const char *name, unsigned initial_count)
+{
+	struct semaphore *sem;
+
+	sem = kmalloc(sizeof(*sem));
+	if (sem == NULL) {
+		return NULL;
+	}
+
+	sem->sem_name = synch_namedup(name);
+	if (sem->sem_name == NULL) {
+		kfree(sem);
+		return NULL;
+	}
+
+	ticketlock_init(&sem->sem_lock);
+	sem->sem_count = initial_count;
+	sem->sem_waiters = 0;
+	sem->sem_allwaiters = 0;
+	sem->sem_anywaiters = NULL;
+	synch_stats_init(&sem->sem_stats, SYNCH_KIND_SEM, sem, sem->sem_name,
+			 &sem->sem_waithist, NULL, &sem->sem_lock);
+
+	return sem;
+}
+
+void
+sem_destroy(struct semaphore *sem)
+{
+	KASSERT(sem != NULL);
+	KASSERT(sem->sem_waiters == 0);
+	KASSERT(sem->sem_allwaiters == 0);
+	KASSERT(sem->sem_anywaiters == NULL);
+
+	synch_stats_cleanup(&sem->sem_stats);
+	ticketlock_cleanup(&sem->sem_lock);
+	synch_namefree(sem->sem_name);
+	kfree(sem);
+}
+
+static
+bool
+sem_blocked(void *arg)
+{
+	struct semaphore *sem = arg;
+
+	return atomic_load(&sem->sem_count) == 0;
+}
+
+void
+P(struct semaphore *sem)
+{
+	uint64_t start = 0;
+
+	KASSERT(sem != NULL);
+
+	/*
+	 * May not block in an interrupt handler.
+	 *
+	 * For robustness, always check, even if we can actually
+	 * complete the P without blocking.
+	 */
+	KASSERT(curthread->t_in_interrupt == false);
+
+	ticketlock_acquire(&sem->sem_lock);
+	if (sem->sem_count == 0) {
+		start = synch_stamp();
+		synch_trace(SYNCH_TR_CONTEND, sem,
+			    SYNCH_TR_ARG(SYNCH_KIND_SEM, 0));
+	}
+	while (sem->sem_count == 0) {
+		/*
+		 *
+		 * Note that we don't maintain strict FIFO ordering of
+		 * threads going through the semaphore; that is, we
+		 * might "get" it on the first try even if other
+		 * threads are waiting. Apparently according to some
+		 * textbooks semaphores must for some reason have
+		 * strict ordering. Too bad. :-)
+		 *
+		 * Exercise: how would you implement strict FIFO
+		 * ordering?
+		 */
+		sem->sem_waiters++;
+		waittable_wait(sem, &sem->sem_lock, sem_blocked, sem);
+		sem->sem_waiters--;
+	}
+	KASSERT(sem->sem_count > 0);
+	sem->sem_count--;
+	if (start != 0) {
+		start = synch_now() - start;
+	}
+	if (SYNCH_STATS && SYNCH_INSTRUMENTING()) {
+		synch_hist_record(&sem->sem_waithist, start);
+	}
+	synch_trace(SYNCH_TR_ACQUIRE, sem, SYNCH_TR_ARG(SYNCH_KIND_SEM, 0));
+	ticketlock_release(&sem->sem_lock);
+
+	if (start != 0) {
+		synch_callsite_record(SYNCH_KIND_SEM, sem, sem->sem_name,
+				      __builtin_return_address(0), start);
+	}
+}
+
+/*
+ * Threads in sem_wait_all sleep on a key of their own, so that a V
+ * meant for a thread in P is never used up waking one of them instead.
+ * Since they may not be able to use the unit anyway, they all get
+ * woken.
+ */
+#define SEM_ALLKEY(sem) ((const void *)&(sem)->sem_count)
+
+/*
+ * A thread in sem_wait_any. It hangs a sem_anylink off each semaphore
+ * it is waiting on; the first V to get to one of them sets aw_fired
+ * and gives it the unit directly. All of this lives on the waiting
+ * thread's stack.
+ */
+#define SEM_ANY_NONE ((unsigned)-1)
+
+struct sem_anywaiter {
+	unsigned aw_fired;		/* index that fired, or SEM_ANY_NONE */
+};
+
+struct sem_anylink {
+	struct sem_anylink *al_next;
+	struct sem_anywaiter *al_waiter;
+	unsigned al_index;
+};
+
+/*
+ * Mark AW as fired by semaphore INDEX, unless something beat us to
+ * it. Returns true if we got there first.
+ */
+static
+bool
+sem_anywaiter_fire(struct sem_anywaiter *aw, unsigned index)
+{
+	return atomic_cas(&aw->aw_fired, SEM_ANY_NONE, index);
+}
+
+static
+bool
+sem_anywaiter_blocked(void *arg)
+{
+	struct sem_anywaiter *aw = arg;
+
+	return atomic_load(&aw->aw_fired) == SEM_ANY_NONE;
+}
+
+void
+V(struct semaphore *sem)
+{
+	struct sem_anylink *al;
+	struct sem_anywaiter *handedto = NULL;
+	bool wake = false, wakeall = false;
+
+	KASSERT(sem != NULL);
+
+	ticketlock_acquire(&sem->sem_lock);
+
+	/*
+	 * Threads in sem_wait_any get the unit directly. Ones that were
+	 * already fired by another semaphore just get unhooked.
+	 */
+	while (sem->sem_anywaiters != NULL) {
+		al = sem->sem_anywaiters;
+		sem->sem_anywaiters = al->al_next;
+		if (sem_anywaiter_fire(al->al_waiter, al->al_index)) {
+			/* Only the address; it may be gone once we unlock. */
+			handedto = al->al_waiter;
+			break;
+		}
+	}
+
+	if (handedto == NULL) {
+		sem->sem_count++;
+		KASSERT(sem->sem_count > 0);
+		wake = (sem->sem_waiters > 0);
+		wakeall = (sem->sem_allwaiters > 0);
+	}
+	synch_trace(handedto != NULL || wake || wakeall ?
+		    SYNCH_TR_HANDOFF : SYNCH_TR_RELEASE, sem,
+		    SYNCH_TR_ARG(SYNCH_KIND_SEM, 0));
+
+	ticketlock_release(&sem->sem_lock);
+
+	if (handedto != NULL) {
+		waittable_wake(handedto, false);
+	}
+	else {
+		if (wake) {
+			waittable_wake(sem, false);
+		}
+		if (wakeall) {
+			waittable_wake(SEM_ALLKEY(sem), true);
+		}
+	}
+}
+
+unsigned
+sem_wait_any(struct semaphore **sems, unsigned n)
+{
+	struct sem_anywaiter aw;
+	struct sem_anylink links[SEM_WAITANY_MAX];
+	struct sem_anylink **pp;
+	struct semaphore *sem;
+	unsigned i, nlinked;
+
+	KASSERT(sems != NULL);
+	KASSERT(n > 0 && n <= SEM_WAITANY_MAX);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	aw.aw_fired = SEM_ANY_NONE;
+
+	/*
+	 * Take the first one that's available, and hook onto the ones
+	 * that aren't. Once we're hooked onto one, a V on it can fire
+	 * us while we're still going through the rest.
+	 */
+	for (nlinked = 0; nlinked < n; nlinked++) {
+		sem = sems[nlinked];
+		KASSERT(sem != NULL);
+
+		ticketlock_acquire(&sem->sem_lock);
+		if (sem->sem_count > 0) {
+			if (sem_anywaiter_fire(&aw, nlinked)) {
+				sem->sem_count--;
+			}
+			ticketlock_release(&sem->sem_lock);
+			break;
+		}
+		if (atomic_load(&aw.aw_fired) != SEM_ANY_NONE) {
+			ticketlock_release(&sem->sem_lock);
+			break;
+		}
+		links[nlinked].al_waiter = &aw;
+		links[nlinked].al_index = nlinked;
+		links[nlinked].al_next = sem->sem_anywaiters;
+		sem->sem_anywaiters = &links[nlinked];
+		ticketlock_release(&sem->sem_lock);
+	}
+
+	waittable_wait(&aw, NULL, sem_anywaiter_blocked, &aw);
+
+	/* Unhook from whatever didn't fire, so no V can find us later. */
+	for (i = 0; i < nlinked; i++) {
+		sem = sems[i];
+		ticketlock_acquire(&sem->sem_lock);
+		for (pp = &sem->sem_anywaiters; *pp != NULL;
+		     pp = &(*pp)->al_next) {
+			if (*pp == &links[i]) {
+				*pp = links[i].al_next;
+				break;
+			}
+		}
+		ticketlock_release(&sem->sem_lock);
+	}
+
+	KASSERT(aw.aw_fired < n);
+	return aw.aw_fired;
+}
+
+/*
+ * What a thread in sem_wait_all is waiting for.
+ */
+struct sem_allwaiter {
+	struct semaphore *lw_sem;
+	unsigned lw_count;
+};
+
+static
+bool
+sem_allwaiter_blocked(void *arg)
+{
+	struct sem_allwaiter *lw = arg;
+
+	return atomic_load(&lw->lw_sem->sem_count) < lw->lw_count;
+}
+
+void
+sem_wait_all(struct semaphore **sems, const unsigned *counts, unsigned n)
+{
+	struct semaphore *sorted[SEM_WAITALL_MAX];
+	unsigned amounts[SEM_WAITALL_MAX];
+	struct sem_allwaiter lw;
+	unsigned i, j;
+
+	KASSERT(sems != NULL);
+	KASSERT(counts != NULL);
+	KASSERT(n > 0 && n <= SEM_WAITALL_MAX);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/*
+	 * We need all the spinlocks at once; always take them in address
+	 * order so two of us can't deadlock.
+	 */
+	for (i = 0; i < n; i++) {
+		KASSERT(sems[i] != NULL);
+		for (j = i; j > 0 && sorted[j - 1] > sems[i]; j--) {
+			sorted[j] = sorted[j - 1];
+			amounts[j] = amounts[j - 1];
+		}
+		KASSERT(j == 0 || sorted[j - 1] != sems[i]);
+		sorted[j] = sems[i];
+		amounts[j] = counts[i];
+	}
+
+	while (1) {
+		for (i = 0; i < n; i++) {
+			ticketlock_acquire(&sorted[i]->sem_lock);
+		}
+
+		for (i = 0; i < n; i++) {
+			if (sorted[i]->sem_count < amounts[i]) {
+				break;
+			}
+		}
+
+		if (i == n) {
+			for (j = n; j-- > 0; ) {
+				sorted[j]->sem_count -= amounts[j];
+				ticketlock_release(&sorted[j]->sem_lock);
+			}
+			return;
+		}
+
+		/*
+		 * SORTED[I] is short. Give everything back and sleep
+		 * until it has enough; then try the whole set again.
+		 */
+		lw.lw_sem = sorted[i];
+		lw.lw_count = amounts[i];
+		lw.lw_sem->sem_allwaiters++;
+		for (j = n; j-- > 0; ) {
+			if (j != i) {
+				ticketlock_release(&sorted[j]->sem_lock);
+			}
+		}
+		waittable_wait(SEM_ALLKEY(lw.lw_sem), &lw.lw_sem->sem_lock,
+			       sem_allwaiter_blocked, &lw);
+		lw.lw_sem->sem_allwaiters--;
+		ticketlock_release(&lw.lw_sem->sem_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Lock.
+
+struct lock *
+lock_create(const char *name)
+{
+        struct lock *lock;
+
+        lock = kmalloc(sizeof(*lock));
+        if (lock == NULL) {
+                return NULL;
+        }
+
+        lock->lk_name = synch_namedup(name);
+        if (lock->lk_name == NULL) {
+                kfree(lock);
+                return NULL;
+        }
+
+	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
+	
+	//the inital state of the holding thread must be NULL
+	//because its value is used to check if the lock is 
+	//available
+	lock->holding_thread = NULL;
+	
+	//nobody is waiting yet; waiters sleep in the wait table,
+	//so there is no waiting channel to create
+	lock->lock_waiters = 0;
+	
+	//statistics start out empty
+	lock->lk_acquired = 0;
+	lock->lk_acqsite = NULL;
+	lock->lk_holdsample = 0;
+	synch_stats_init(&lock->lk_stats, SYNCH_KIND_LOCK, lock, lock->lk_name,
+			 &lock->lk_waithist, &lock->lk_holdhist, NULL);
+	
+	return lock;
+}
+
+void
+lock_destroy(struct lock *lock)
+{
+        KASSERT(lock != NULL);
+	KASSERT(lock->lock_waiters == 0);
+	KASSERT(lock->holding_thread == NULL);
+	synch_stats_cleanup(&lock->lk_stats);
+	//Deallocate the lock and its name
+        synch_namefree(lock->lk_name);
+        kfree(lock);
+}
+
+/*
+ * holding_thread as the pointer the atomic operations take.
+ */
+#define LOCK_HOLDER(lock) ((void *volatile *)&(lock)->holding_thread)
+
+static
+bool
+lock_blocked(void *arg)
+{
+	struct lock *lock = arg;
+
+	return atomic_load_ptr(LOCK_HOLDER(lock)) != NULL;
+}
+
+void
+lock_acquire(struct lock *lock)
+{
+	uint64_t start = 0, now = 0;
+	bool sample;
+
+        //Ensure that the lock being passed in exists
+	KASSERT(lock != NULL);
+        
+	//Check that the calling thread is not being interrupted
+	KASSERT(curthread->t_in_interrupt == false);
+	
+	//Ensure that the calling thread does not already hold the lock
+	KASSERT(!lock_do_i_hold(lock));
+	
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+
+        // The lock is free exactly when holding_thread is NULL, so a single
+        // compare-and-swap from NULL to curthread both checks and takes it.
+        // If another thread holds the lock, count ourselves as a waiter and
+        // sleep in the wait table until it's released, then try again.
+	while(!atomic_cas_ptr(LOCK_HOLDER(lock), NULL, curthread))
+	{
+	if (start == 0) {
+		start = synch_stamp();
+		synch_trace(SYNCH_TR_CONTEND, lock,
+			    SYNCH_TR_ARG(SYNCH_KIND_LOCK, 0));
+	}
+	atomic_fetch_add(&lock->lock_waiters, 1);
+	waittable_wait(lock, NULL, lock_blocked, lock);
+	atomic_fetch_sub(&lock->lock_waiters, 1);
+	}
+	
+	//we're the holder now, so the statistics are ours to update.
+	//Reading the clock costs more than the whole uncontended
+	//acquire, so only a wait gets a timestamp at this end, and the
+	//hold time is only measured for one acquisition in
+	//SYNCH_HOLD_SAMPLE, or every one if there's a hold limit to
+	//check it against. lk_acquired stays 0 when it isn't, which
+	//tells lock_release not to count it.
+	lock->lk_acquired = 0;
+	if (SYNCH_STATS && SYNCH_INSTRUMENTING()) {
+		sample = atomic_load(&lock->lk_stats.ss_holdlimit) != 0 ||
+			++lock->lk_holdsample % SYNCH_HOLD_SAMPLE == 0;
+		if (start != 0 || sample) {
+			now = synch_now();
+		}
+		if (sample) {
+			lock->lk_acquired = now;
+			lock->lk_acqsite = __builtin_return_address(0);
+		}
+		synch_hist_record(&lock->lk_waithist, start == 0 ?
+				  0 : now - start);
+		//if we had to wait, charge it to whoever called us
+		if (start != 0) {
+			synch_callsite_record(SYNCH_KIND_LOCK, lock,
+					      lock->lk_name,
+					      __builtin_return_address(0),
+					      now - start);
+		}
+	}
+	synch_trace(SYNCH_TR_ACQUIRE, lock, SYNCH_TR_ARG(SYNCH_KIND_LOCK, 0));
+	
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+}
+
+void
+lock_release(struct lock *lock)
+{
+	uint64_t held;
+	unsigned limit;
+
+        //Ensure that the lock being passed in exists
+	KASSERT(lock != NULL);
+	
+	//ensure that the calling thread has the lock
+	KASSERT(lock_do_i_hold(lock));
+
+	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
+
+	//count the hold time while we still own the statistics, and
+	//log it if it's over the limit for this kind of lock
+	if (SYNCH_STATS && lock->lk_acquired != 0) {
+		held = synch_now() - lock->lk_acquired;
+		synch_hist_record(&lock->lk_holdhist, held);
+		limit = atomic_load(&lock->lk_stats.ss_holdlimit);
+		if (limit != 0 && held > limit * 1000ULL) {
+			synch_holdlog_record(lock, held);
+		}
+	}
+	
+	//trace it before letting go, so it comes before the next
+	//holder's acquire; whether anyone is waiting is only a guess
+	//this early, but good enough for a trace
+	synch_trace(atomic_load(&lock->lock_waiters) > 0 ?
+		    SYNCH_TR_HANDOFF : SYNCH_TR_RELEASE, lock,
+		    SYNCH_TR_ARG(SYNCH_KIND_LOCK, 0));
+
+	//The lock is released; the release store keeps the critical
+	//section from leaking past it
+	atomic_store_ptr_release(LOCK_HOLDER(lock), NULL);
+
+	//A waiter counts itself before it checks holding_thread, and we
+	//clear holding_thread before we check the count, so with a full
+	//fence in between at least one of us sees the other. Only wake
+	//somebody up if there is somebody.
+	atomic_fence_seq_cst();
+	if (atomic_load(&lock->lock_waiters) > 0) {
+		waittable_wake(lock, false);
+	}
+}
+
+bool
+lock_do_i_hold(struct lock *lock)
+{
+	//returns true when the calling thread 
+	//holds the lock
+        KASSERT(lock != NULL);
+	
+	return (atomic_load_ptr(LOCK_HOLDER(lock)) == curthread);
+}
+
+
+////////////////////////////////////////////////////////////
+//
+// Hold-time watchdog.
+
+struct synch_holdrec {
+	char hr_lock[16];		/* names, cut short */
+	char hr_thread[16];
+	const void *hr_site;		/* where it was acquired */
+	uint64_t hr_held;		/* nanoseconds */
+};
+
+static struct spinlock synch_holdlog_lock = SPINLOCK_INITIALIZER;
+static struct synch_holdrec synch_holdlog[SYNCH_HOLDLOG_SIZE];
+static unsigned synch_holdlog_head;	/* records logged, ever */
+
+/*
+ * What synch_holdlimit_print copies out from under the spinlocks, so
+ * that it can print without holding them.
+ */
+struct synch_holdcopy {
+	struct {
+		char hl_name[16];	/* cut short */
+		unsigned hl_us;
+	} hc_limits[SYNCH_HOLDLIMIT_MAX];
+	unsigned hc_nlimits;
+	struct synch_holdrec hc_log[SYNCH_HOLDLOG_SIZE];
+	unsigned hc_nlog;
+	unsigned hc_dropped;
+};
+
+/*
+ * Offenders one watchdog scan reports, copied likewise; any more are
+ * only counted.
+ */
+#define SYNCH_WATCHDOG_REPORT	8
+
+struct synch_watchrec {
+	char wd_lock[16];		/* name, cut short */
+	const struct lock *wd_object;
+	const void *wd_holder;
+	const void *wd_site;
+	uint64_t wd_held;		/* nanoseconds */
+};
+
+static unsigned synch_watchdog_period;	/* seconds; 0 to stop */
+static unsigned synch_watchdog_running;
+
+/*
+ * Log that LOCK, which we are about to release, was held for HELD.
+ */
+static
+void
+synch_holdlog_record(struct lock *lock, uint64_t held)
+{
+	struct synch_holdrec *hr;
+
+	spinlock_acquire(&synch_holdlog_lock);
+	hr = &synch_holdlog[synch_holdlog_head % SYNCH_HOLDLOG_SIZE];
+	snprintf(hr->hr_lock, sizeof(hr->hr_lock), "%s", lock->lk_name);
+	snprintf(hr->hr_thread, sizeof(hr->hr_thread), "%s",
+		 curthread->t_name);
+	hr->hr_site = lock->lk_acqsite;
+	hr->hr_held = held;
+	synch_holdlog_head++;
+	spinlock_release(&synch_holdlog_lock);
+}
+
+int
+synch_holdlimit_set(const char *name, unsigned us)
+{
+	struct synch_holdlimit *hl = NULL;
+	struct synch_stats *ss;
+	char *copy, *oldname = NULL;
+	unsigned i;
+	int result = 0;
+
+	copy = kstrdup(name);
+	if (copy == NULL) {
+		return ENOMEM;
+	}
+
+	spinlock_acquire(&synch_stats_lock);
+	/* The slot with this name, else the first free one. */
+	for (i = 0; i < SYNCH_HOLDLIMIT_MAX; i++) {
+		if (synch_holdlimits[i].hl_name == NULL) {
+			if (hl == NULL) {
+				hl = &synch_holdlimits[i];
+			}
+		}
+		else if (!strcmp(synch_holdlimits[i].hl_name, name)) {
+			hl = &synch_holdlimits[i];
+			break;
+		}
+	}
+
+	if (hl == NULL) {
+		if (us != 0) {
+			result = ENOSPC;
+		}
+	}
+	else if (us == 0) {
+		oldname = hl->hl_name;
+		hl->hl_name = NULL;
+		hl->hl_us = 0;
+	}
+	else {
+		if (hl->hl_name == NULL) {
+			hl->hl_name = copy;
+			copy = NULL;
+		}
+		hl->hl_us = us;
+	}
+
+	if (result == 0) {
+		for (ss = synch_stats_list; ss != NULL; ss = ss->ss_next) {
+			if (ss->ss_kind == SYNCH_KIND_LOCK &&
+			    !strcmp(ss->ss_name, name)) {
+				atomic_store(&ss->ss_holdlimit, us);
+			}
+		}
+	}
+	spinlock_release(&synch_stats_lock);
+
+	kfree(copy);
+	kfree(oldname);
+	return result;
+}
+
+void
+synch_holdlimit_print(void)
+{
+	struct synch_holdcopy *hc;
+	unsigned i, first;
+
+	hc = kmalloc(sizeof(*hc));
+	if (hc == NULL) {
+		kprintf("synch_holdlimit_print: out of memory\n");
+		return;
+	}
+
+	hc->hc_nlimits = 0;
+	spinlock_acquire(&synch_stats_lock);
+	for (i = 0; i < SYNCH_HOLDLIMIT_MAX; i++) {
+		if (synch_holdlimits[i].hl_name != NULL) {
+			snprintf(hc->hc_limits[hc->hc_nlimits].hl_name,
+				 sizeof(hc->hc_limits[0].hl_name), "%s",
+				 synch_holdlimits[i].hl_name);
+			hc->hc_limits[hc->hc_nlimits++].hl_us =
+				synch_holdlimits[i].hl_us;
+		}
+	}
+	spinlock_release(&synch_stats_lock);
+
+	/* Oldest first. */
+	hc->hc_nlog = 0;
+	spinlock_acquire(&synch_holdlog_lock);
+	first = synch_holdlog_head < SYNCH_HOLDLOG_SIZE ?
+		0 : synch_holdlog_head - SYNCH_HOLDLOG_SIZE;
+	for (i = first; i < synch_holdlog_head; i++) {
+		hc->hc_log[hc->hc_nlog++] =
+			synch_holdlog[i % SYNCH_HOLDLOG_SIZE];
+	}
+	hc->hc_dropped = first;
+	spinlock_release(&synch_holdlog_lock);
+
+	for (i = 0; i < hc->hc_nlimits; i++) {
+		kprintf("lock %s: hold limit %u us\n",
+			hc->hc_limits[i].hl_name, hc->hc_limits[i].hl_us);
+	}
+	for (i = 0; i < hc->hc_nlog; i++) {
+		kprintf("lock %s held %llu us by %s, acquired from %p\n",
+			hc->hc_log[i].hr_lock,
+			(unsigned long long)(hc->hc_log[i].hr_held / 1000),
+			hc->hc_log[i].hr_thread, hc->hc_log[i].hr_site);
+	}
+	if (hc->hc_dropped > 0) {
+		kprintf("(%u older ones dropped)\n", hc->hc_dropped);
+	}
+	kfree(hc);
+}
+
+/*
+ * Report the locks that are held past their limit right now. Nothing
+ * here stops the holder from letting go as we look, so this may
+ * report a lock just after it was released, or charge a new holder
+ * with some of the old one's time. The locks themselves can't go
+ * away while we look, since lock_destroy has to get synch_stats_lock
+ * first; what we print is copied out before we let go of it.
+ */
+static
+void
+synch_watchdog_scan(void)
+{
+	struct synch_watchrec found[SYNCH_WATCHDOG_REPORT];
+	struct synch_stats *ss;
+	struct lock *lock;
+	void *holder;
+	uint64_t now, held;
+	unsigned limit, n = 0, more = 0, i;
+
+	now = synch_now();
+	spinlock_acquire(&synch_stats_lock);
+	for (ss = synch_stats_list; ss != NULL; ss = ss->ss_next) {
+		limit = ss->ss_holdlimit;
+		if (ss->ss_kind != SYNCH_KIND_LOCK || limit == 0) {
+			continue;
+		}
+		lock = ss->ss_object;
+		holder = atomic_load_ptr(LOCK_HOLDER(lock));
+		if (holder == NULL) {
+			continue;
+		}
+		held = now - lock->lk_acquired;
+		if (lock->lk_acquired == 0 || lock->lk_acquired >= now ||
+		    held <= limit * 1000ULL) {
+			continue;
+		}
+		if (n == SYNCH_WATCHDOG_REPORT) {
+			more++;
+			continue;
+		}
+		snprintf(found[n].wd_lock, sizeof(found[n].wd_lock), "%s",
+			 lock->lk_name);
+		found[n].wd_object = lock;
+		found[n].wd_holder = holder;
+		found[n].wd_site = lock->lk_acqsite;
+		found[n].wd_held = held;
+		n++;
+	}
+	spinlock_release(&synch_stats_lock);
+
+	for (i = 0; i < n; i++) {
+		kprintf("synch watchdog: lock %s (%p) held %llu us "
+			"by thread %p, acquired from %p\n",
+			found[i].wd_lock, found[i].wd_object,
+			(unsigned long long)(found[i].wd_held / 1000),
+			found[i].wd_holder, found[i].wd_site);
+	}
+	if (more > 0) {
+		kprintf("synch watchdog: and %u more\n", more);
+	}
+}
+
+static
+void
+synch_watchdog_thread(void *unused1, unsigned long unused2)
+{
+	unsigned period;
+
+	(void)unused1;
+	(void)unused2;
+
+	for (;;) {
+		period = atomic_load(&synch_watchdog_period);
+		if (period != 0) {
+			clocksleep(period);
+			synch_watchdog_scan();
+			continue;
+		}
+
+		/*
+		 * Stopped. A synch_watchdog_start that still saw us
+		 * running counted on us to carry on, so look again once
+		 * it can see we're not.
+		 */
+		atomic_store(&synch_watchdog_running, 0);
+		atomic_fence_seq_cst();
+		if (atomic_load(&synch_watchdog_period) == 0 ||
+		    !atomic_cas(&synch_watchdog_running, 0, 1)) {
+			break;
+		}
+	}
+}
+
+int
+synch_watchdog_start(unsigned period)
+{
+	int result;
+
+	if (period == 0) {
+		return EINVAL;
+	}
+
+	atomic_store(&synch_watchdog_period, period);
+	atomic_fence_seq_cst();
+	if (!atomic_cas(&synch_watchdog_running, 0, 1)) {
+		/* Already running; it'll pick up the new period. */
+		return 0;
+	}
+
+	result = thread_fork("synch watchdog", NULL, synch_watchdog_thread,
+			     NULL, 0);
+	if (result) {
+		atomic_store(&synch_watchdog_running, 0);
+		return result;
+	}
+	return 0;
+}
+
+void
+synch_watchdog_stop(void)
+{
+	atomic_store(&synch_watchdog_period, 0);
+}
+
+////////////////////////////////////////////////////////////
+//
+// CV
+
+
+struct cv *
+cv_create(const char *name)
+{
+	struct cv *cv;
+
+	cv = kmalloc(sizeof(*cv));
+	if (cv == NULL) {
+		return NULL;
+	}
+
+	cv->cv_name = synch_namedup(name);
+	if (cv->cv_name==NULL) {
+		kfree(cv);
+		return NULL;
+	}
+
+	//no signals yet, and nobody waiting
+	cv->cv_seq = 0;
+	cv->cv_waiters = 0;
+	synch_stats_init(&cv->cv_stats, SYNCH_KIND_CV, cv, cv->cv_name,
+			 &cv->cv_waithist, NULL, NULL);
+
+	return cv;
+}
+
+void
+cv_destroy(struct cv *cv)
+{
+	KASSERT(cv != NULL);
+	KASSERT(cv->cv_waiters == 0);
+
+	synch_stats_cleanup(&cv->cv_stats);
+	synch_namefree(cv->cv_name);
+	kfree(cv);
+}
+
+/*
+ * What a thread in cv_wait is waiting for: the sequence number to move
+ * on from the value it saw.
+ */
+struct cv_waiter {
+	struct cv *cw_cv;
+	unsigned cw_seq;
+};
+
+static
+bool
+cv_blocked(void *arg)
+{
+	struct cv_waiter *cw = arg;
+
+	return atomic_load(&cw->cw_cv->cv_seq) == cw->cw_seq;
+}
+
+void
+cv_wait(struct cv *cv, struct lock *lock)
+{
+	struct cv_waiter cw;
+	uint64_t start;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	//the caller has to hold the lock that goes with the CV
+	KASSERT(lock_do_i_hold(lock));
+
+	//Take the sequence number and count ourselves while we still
+	//hold the lock. Signals come from threads holding the lock, so
+	//any signal after we let go of it moves the sequence number and
+	//sees us counted; there is no window for it to get lost in.
+	cw.cw_cv = cv;
+	cw.cw_seq = atomic_load(&cv->cv_seq);
+	atomic_fetch_add(&cv->cv_waiters, 1);
+	start = synch_stamp();
+	synch_trace(SYNCH_TR_CONTEND, cv, SYNCH_TR_ARG(SYNCH_KIND_CV, 0));
+
+	lock_release(lock);
+	waittable_wait(cv, NULL, cv_blocked, &cw);
+	atomic_fetch_sub(&cv->cv_waiters, 1);
+
+	//Mesa semantics: the caller checks its condition again
+	lock_acquire(lock);
+	if (start != 0) {
+		synch_hist_record(&cv->cv_waithist, synch_now() - start);
+	}
+	synch_trace(SYNCH_TR_ACQUIRE, cv, SYNCH_TR_ARG(SYNCH_KIND_CV, 0));
+}
+
+void
+cv_signal(struct cv *cv, struct lock *lock)
+{
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	synch_trace(SYNCH_TR_SIGNAL, cv, SYNCH_TR_ARG(SYNCH_KIND_CV, 0));
+	atomic_fetch_add(&cv->cv_seq, 1);
+	if (atomic_load(&cv->cv_waiters) > 0) {
+		waittable_wake(cv, false);
+	}
+}
+
+void
+cv_broadcast(struct cv *cv, struct lock *lock)
+{
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	synch_trace(SYNCH_TR_SIGNAL, cv, SYNCH_TR_ARG(SYNCH_KIND_CV, 1));
+	atomic_fetch_add(&cv->cv_seq, 1);
+	if (atomic_load(&cv->cv_waiters) > 0) {
+		waittable_wake(cv, true);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rwlock_name = synch_namedup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	ticketlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_readers_waiting = 0;
+	rw->rw_writers_waiting = 0;
+	rw->rw_writer = NULL;
+	rw->rw_upgrader = NULL;
+	rw->rw_upgrading = false;
+	synch_stats_init(&rw->rw_stats, SYNCH_KIND_RWLOCK, rw, rw->rwlock_name,
+			 NULL, NULL, &rw->rw_lock);
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_readers_waiting == 0);
+	KASSERT(rw->rw_writers_waiting == 0);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_upgrader == NULL);
+
+	synch_stats_cleanup(&rw->rw_stats);
+	ticketlock_cleanup(&rw->rw_lock);
+	synch_namefree(rw->rwlock_name);
+	kfree(rw);
+}
+
+/*
+ * Readers and upgradable readers, writers, and an upgrader waiting
+ * for readers to drain each sleep on their own wait table key.
+ */
+#define RW_READKEY(rw)		((const void *)&(rw)->rw_readers)
+#define RW_WRITEKEY(rw)		((const void *)&(rw)->rw_writer)
+#define RW_UPGRADEKEY(rw)	((const void *)&(rw)->rw_upgrader)
+
+static
+bool
+rwlock_read_blocked(void *arg)
+{
+	struct rwlock *rw = arg;
+
+	return rw->rw_writer != NULL || rw->rw_writers_waiting > 0 ||
+		rw->rw_upgrading;
+}
+
+static
+bool
+rwlock_write_blocked(void *arg)
+{
+	struct rwlock *rw = arg;
+
+	return rw->rw_writer != NULL || rw->rw_readers > 0 ||
+		rw->rw_upgrader != NULL;
+}
+
+static
+bool
+rwlock_upgrade_blocked(void *arg)
+{
+	struct rwlock *rw = arg;
+
+	return rw->rw_writer != NULL || rw->rw_writers_waiting > 0 ||
+		rw->rw_upgrader != NULL;
+}
+
+static
+bool
+rwlock_drain_blocked(void *arg)
+{
+	struct rwlock *rw = arg;
+
+	return rw->rw_readers > 0;
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	uint64_t start = 0;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	ticketlock_acquire(&rw->rw_lock);
+	/*
+	 * Stay out while a writer is waiting or an upgrade is pending;
+	 * either one is only waiting for the current readers to leave.
+	 */
+	if (rwlock_read_blocked(rw)) {
+		start = synch_stamp();
+		synch_trace(SYNCH_TR_CONTEND, rw,
+			    SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 0));
+	}
+	while (rwlock_read_blocked(rw)) {
+		rw->rw_readers_waiting++;
+		waittable_wait(RW_READKEY(rw), &rw->rw_lock,
+			       rwlock_read_blocked, rw);
+		rw->rw_readers_waiting--;
+	}
+	rw->rw_readers++;
+	synch_trace(SYNCH_TR_ACQUIRE, rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 0));
+	ticketlock_release(&rw->rw_lock);
+
+	if (start != 0) {
+		synch_callsite_record(SYNCH_KIND_RWLOCK, rw, rw->rwlock_name,
+				      __builtin_return_address(0),
+				      synch_now() - start);
+	}
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	const void *wakekey = NULL;
+
+	KASSERT(rw != NULL);
+
+	ticketlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0) {
+		if (rw->rw_upgrading) {
+			wakekey = RW_UPGRADEKEY(rw);
+		}
+		else if (rw->rw_writers_waiting > 0 &&
+			 rw->rw_upgrader == NULL) {
+			wakekey = RW_WRITEKEY(rw);
+		}
+	}
+	synch_trace(wakekey != NULL ? SYNCH_TR_HANDOFF : SYNCH_TR_RELEASE,
+		    rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 0));
+	ticketlock_release(&rw->rw_lock);
+
+	if (wakekey != NULL) {
+		waittable_wake(wakekey, false);
+	}
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	uint64_t start = 0;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	ticketlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	rw->rw_writers_waiting++;
+	if (rwlock_write_blocked(rw)) {
+		start = synch_stamp();
+		synch_trace(SYNCH_TR_CONTEND, rw,
+			    SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 1));
+	}
+	while (rwlock_write_blocked(rw)) {
+		waittable_wait(RW_WRITEKEY(rw), &rw->rw_lock,
+			       rwlock_write_blocked, rw);
+	}
+	rw->rw_writers_waiting--;
+	rw->rw_writer = curthread;
+	synch_trace(SYNCH_TR_ACQUIRE, rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 1));
+	ticketlock_release(&rw->rw_lock);
+
+	if (start != 0) {
+		synch_callsite_record(SYNCH_KIND_RWLOCK, rw, rw->rwlock_name,
+				      __builtin_return_address(0),
+				      synch_now() - start);
+	}
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	const void *wakekey = NULL;
+
+	KASSERT(rw != NULL);
+
+	ticketlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	if (rw->rw_writers_waiting > 0) {
+		wakekey = RW_WRITEKEY(rw);
+	}
+	else if (rw->rw_readers_waiting > 0) {
+		wakekey = RW_READKEY(rw);
+	}
+	synch_trace(wakekey != NULL ? SYNCH_TR_HANDOFF : SYNCH_TR_RELEASE,
+		    rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 1));
+	ticketlock_release(&rw->rw_lock);
+
+	if (wakekey != NULL) {
+		/* Let all the readers in, but only one writer. */
+		waittable_wake(wakekey, wakekey == RW_READKEY(rw));
+	}
+}
+
+void
+rwlock_acquire_upgrade(struct rwlock *rw)
+{
+	uint64_t start = 0;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	ticketlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_upgrader != curthread);
+	if (rwlock_upgrade_blocked(rw)) {
+		start = synch_stamp();
+		synch_trace(SYNCH_TR_CONTEND, rw,
+			    SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 0));
+	}
+	while (rwlock_upgrade_blocked(rw)) {
+		rw->rw_readers_waiting++;
+		waittable_wait(RW_READKEY(rw), &rw->rw_lock,
+			       rwlock_upgrade_blocked, rw);
+		rw->rw_readers_waiting--;
+	}
+	rw->rw_upgrader = curthread;
+	synch_trace(SYNCH_TR_ACQUIRE, rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 0));
+	ticketlock_release(&rw->rw_lock);
+
+	if (start != 0) {
+		synch_callsite_record(SYNCH_KIND_RWLOCK, rw, rw->rwlock_name,
+				      __builtin_return_address(0),
+				      synch_now() - start);
+	}
+}
+
+void
+rwlock_release_upgrade(struct rwlock *rw)
+{
+	const void *wakekey = NULL;
+
+	KASSERT(rw != NULL);
+
+	ticketlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_upgrader == curthread);
+	KASSERT(!rw->rw_upgrading);
+	rw->rw_upgrader = NULL;
+	if (rw->rw_writers_waiting > 0) {
+		/* Otherwise the last reader out wakes the writer. */
+		if (rw->rw_readers == 0) {
+			wakekey = RW_WRITEKEY(rw);
+		}
+	}
+	else if (rw->rw_readers_waiting > 0) {
+		/* Let the next upgradable reader in. */
+		wakekey = RW_READKEY(rw);
+	}
+	synch_trace(wakekey != NULL ? SYNCH_TR_HANDOFF : SYNCH_TR_RELEASE,
+		    rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 0));
+	ticketlock_release(&rw->rw_lock);
+
+	if (wakekey != NULL) {
+		waittable_wake(wakekey, wakekey == RW_READKEY(rw));
+	}
+}
+
+void
+rwlock_upgrade(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	ticketlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_upgrader == curthread);
+	KASSERT(!rw->rw_upgrading);
+
+	/*
+	 * Writers are already kept out by rw_upgrader, so all we have
+	 * to do is stop new readers and wait for the current ones.
+	 * rw_upgrading also tells the last reader out to wake us.
+	 * In a trace, the read hold ends here and the write hold
+	 * starts once they're gone, both marked as a mode change.
+	 */
+	synch_trace(SYNCH_TR_RELEASE, rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 2));
+	rw->rw_upgrading = true;
+	if (rw->rw_readers > 0) {
+		synch_trace(SYNCH_TR_CONTEND, rw,
+			    SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 3));
+	}
+	while (rw->rw_readers > 0) {
+		waittable_wait(RW_UPGRADEKEY(rw), &rw->rw_lock,
+			       rwlock_drain_blocked, rw);
+	}
+	rw->rw_upgrading = false;
+	rw->rw_upgrader = NULL;
+	rw->rw_writer = curthread;
+	synch_trace(SYNCH_TR_ACQUIRE, rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 3));
+	ticketlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_downgrade(struct rwlock *rw)
+{
+	bool wake;
+
+	KASSERT(rw != NULL);
+
+	ticketlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	rw->rw_readers++;
+	wake = (rw->rw_readers_waiting > 0);
+	/* The write hold ends and a read hold starts, as in upgrade. */
+	synch_trace(wake ? SYNCH_TR_HANDOFF : SYNCH_TR_RELEASE, rw,
+		    SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 3));
+	synch_trace(SYNCH_TR_ACQUIRE, rw, SYNCH_TR_ARG(SYNCH_KIND_RWLOCK, 2));
+	ticketlock_release(&rw->rw_lock);
+
+	/* Readers still defer to waiting writers when they wake up. */
+	if (wake) {
+		waittable_wake(RW_READKEY(rw), true);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// CPU clusters.
+
+static unsigned synch_clusters[SYNCH_CLUSTER_MAXCPUS];
+
+void
+synch_cluster_set(unsigned cpu, unsigned cluster)
+{
+	KASSERT(cluster < SYNCH_MAXCLUSTERS);
+	if (cpu < SYNCH_CLUSTER_MAXCPUS) {
+		atomic_store(&synch_clusters[cpu], cluster);
+	}
+}
+
+unsigned
+synch_cluster(unsigned cpu)
+{
+	if (cpu < SYNCH_CLUSTER_MAXCPUS) {
+		return atomic_load(&synch_clusters[cpu]);
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Cohort lock.
+
+/*
+ * A thread in cohortlock_acquire sleeps on its cluster's cc_locked for
+ * the local lock, and on ck_serving for its ticket for the global one.
+ */
+struct cohort_waiter {
+	struct cohortlock *cw_lock;
+	unsigned cw_ticket;
+};
+
+struct cohortlock *
+cohortlock_create(const char *name)
+{
+	struct cohortlock *ck;
+	struct cohort_cluster *cc;
+	unsigned i;
+
+	ck = kmalloc(sizeof(*ck));
+	if (ck == NULL) {
+		return NULL;
+	}
+
+	ck->ck_name = synch_namedup(name);
+	if (ck->ck_name == NULL) {
+		kfree(ck);
+		return NULL;
+	}
+
+	for (i = 0; i < SYNCH_MAXCLUSTERS; i++) {
+		cc = &ck->ck_clusters[i];
+		cc->cc_locked = 0;
+		cc->cc_waiters = 0;
+		cc->cc_global = 0;
+		cc->cc_batch = 0;
+		cc->cc_holder = NULL;
+		cc->cc_local = 0;
+		cc->cc_remote = 0;
+	}
+	ck->ck_next = 0;
+	ck->ck_serving = 0;
+	ck->ck_waiters = 0;
+	ck->ck_owner = 0;
+	synch_stats_init(&ck->ck_stats, SYNCH_KIND_COHORT, ck, ck->ck_name,
+			 NULL, NULL, NULL);
+
+	return ck;
+}
+
+void
+cohortlock_destroy(struct cohortlock *ck)
+{
+	unsigned i;
+
+	KASSERT(ck != NULL);
+	for (i = 0; i < SYNCH_MAXCLUSTERS; i++) {
+		KASSERT(ck->ck_clusters[i].cc_locked == 0);
+		KASSERT(ck->ck_clusters[i].cc_waiters == 0);
+		KASSERT(ck->ck_clusters[i].cc_global == 0);
+	}
+	KASSERT(ck->ck_next == ck->ck_serving);
+	KASSERT(ck->ck_waiters == 0);
+
+	synch_stats_cleanup(&ck->ck_stats);
+	synch_namefree(ck->ck_name);
+	kfree(ck);
+}
+
+static
+bool
+cohortlock_local_blocked(void *arg)
+{
+	struct cohort_cluster *cc = arg;
+
+	return atomic_load(&cc->cc_locked) != 0;
+}
+
+static
+bool
+cohortlock_global_blocked(void *arg)
+{
+	struct cohort_waiter *cw = arg;
+
+	return atomic_load(&cw->cw_lock->ck_serving) != cw->cw_ticket;
+}
+
+void
+cohortlock_acquire(struct cohortlock *ck)
+{
+	struct cohort_cluster *cc;
+	struct cohort_waiter cw;
+	unsigned cluster;
+
+	KASSERT(ck != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(!cohortlock_do_i_hold(ck));
+
+	/*
+	 * The local lock, like struct lock: count ourselves before
+	 * looking again, so a release that clears cc_locked sees us.
+	 */
+	cluster = synch_cluster(curcpu->c_number);
+	cc = &ck->ck_clusters[cluster];
+	while (!atomic_cas(&cc->cc_locked, 0, 1)) {
+		atomic_fetch_add(&cc->cc_waiters, 1);
+		waittable_wait(&cc->cc_locked, NULL, cohortlock_local_blocked,
+			       cc);
+		atomic_fetch_sub(&cc->cc_waiters, 1);
+	}
+
+	/*
+	 * cc_global is only touched with the local lock held. If the
+	 * last holder here passed the global lock on with it, it's ours;
+	 * otherwise take a ticket, at most one per cluster at a time.
+	 */
+	if (cc->cc_global) {
+		cc->cc_global = 0;
+	}
+	else {
+		cw.cw_lock = ck;
+		cw.cw_ticket = atomic_fetch_add(&ck->ck_next, 1);
+		while (atomic_load_acquire(&ck->ck_serving) != cw.cw_ticket) {
+			atomic_fetch_add(&ck->ck_waiters, 1);
+			waittable_wait(&ck->ck_serving, NULL,
+				       cohortlock_global_blocked, &cw);
+			atomic_fetch_sub(&ck->ck_waiters, 1);
+		}
+	}
+	ck->ck_owner = cluster;
+	cc->cc_holder = curthread;
+}
+
+void
+cohortlock_release(struct cohortlock *ck)
+{
+	struct cohort_cluster *cc;
+	bool queued;
+
+	KASSERT(ck != NULL);
+	cc = &ck->ck_clusters[ck->ck_owner];
+	KASSERT(cc->cc_holder == curthread);
+	cc->cc_holder = NULL;
+
+	/*
+	 * Keep the global lock in the cluster if someone here is waiting
+	 * and the batch isn't used up, or nobody elsewhere wants it: the
+	 * tickets after ours belong to other clusters.
+	 */
+	queued = atomic_load(&ck->ck_next) - ck->ck_serving > 1;
+	if (atomic_load(&cc->cc_waiters) > 0 &&
+	    (cc->cc_batch < COHORT_BATCH || !queued)) {
+		cc->cc_global = 1;
+		cc->cc_batch = cc->cc_batch < COHORT_BATCH ?
+			cc->cc_batch + 1 : 1;
+		cc->cc_local++;
+	}
+	else {
+		cc->cc_batch = 0;
+		if (queued) {
+			cc->cc_remote++;
+		}
+		atomic_store_release(&ck->ck_serving, ck->ck_serving + 1);
+		/* As for the local lock below. */
+		atomic_fence_seq_cst();
+		if (atomic_load(&ck->ck_waiters) > 0) {
+			/* Only the next ticket gets past; few are asleep. */
+			waittable_wake(&ck->ck_serving, true);
+		}
+	}
+
+	/*
+	 * A waiter counts itself before it looks at cc_locked, and we
+	 * clear cc_locked before we look at the count, so with a full
+	 * fence in between at least one of us sees the other. cc_global
+	 * goes to whoever takes it next, through the release store.
+	 */
+	atomic_store_release(&cc->cc_locked, 0);
+	atomic_fence_seq_cst();
+	if (atomic_load(&cc->cc_waiters) > 0) {
+		waittable_wake(&cc->cc_locked, false);
+	}
+}
+
+bool
+cohortlock_do_i_hold(struct cohortlock *ck)
+{
+	unsigned i;
+
+	for (i = 0; i < SYNCH_MAXCLUSTERS; i++) {
+		if (atomic_load_ptr((void **)&ck->ck_clusters[i].cc_holder) ==
+		    curthread) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The counts are only updated by holders, so these are only exact
+ * with the lock held or idle.
+ */
+void
+cohortlock_handoffs(struct cohortlock *ck, unsigned *local,
+		    unsigned *remote)
+{
+	unsigned i;
+
+	for (i = 0; i < SYNCH_MAXCLUSTERS; i++) {
+		*local += atomic_load(&ck->ck_clusters[i].cc_local);
+		*remote += atomic_load(&ck->ck_clusters[i].cc_remote);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Sharded counting semaphore.
+
+struct shardsem *
+shardsem_create(const char *name, unsigned initial_count)
+{
+	struct shardsem *shs;
+	unsigned i;
+
+	shs = kmalloc(sizeof(*shs));
+	if (shs == NULL) {
+		return NULL;
+	}
+
+	shs->shs_name = synch_namedup(name);
+	if (shs->shs_name == NULL) {
+		kfree(shs);
+		return NULL;
+	}
+
+	for (i = 0; i < SHARDSEM_MAXCPUS; i++) {
+		shs->shs_caches[i].sc_units = 0;
+	}
+	ticketlock_init(&shs->shs_lock);
+	shs->shs_pool = initial_count;
+	shs->shs_waiters = 0;
+	shs->shs_refills = 0;
+	shs->shs_flushes = 0;
+	shs->shs_steals = 0;
+	synch_stats_init(&shs->shs_stats, SYNCH_KIND_SHARDSEM, shs,
+			 shs->shs_name, NULL, NULL, &shs->shs_lock);
+
+	return shs;
+}
+
+void
+shardsem_destroy(struct shardsem *shs)
+{
+	KASSERT(shs != NULL);
+	KASSERT(shs->shs_waiters == 0);
+
+	synch_stats_cleanup(&shs->shs_stats);
+	ticketlock_cleanup(&shs->shs_lock);
+	synch_namefree(shs->shs_name);
+	kfree(shs);
+}
+
+/*
+ * This CPU's cache, or NULL if it has none. A thread that moves to
+ * another CPU right after may end up using the old CPU's cache, which
+ * costs a shared write but is otherwise harmless; all the cache
+ * operations are atomic.
+ */
+static
+struct shardsem_cache *
+shardsem_mycache(struct shardsem *shs)
+{
+	unsigned n;
+
+	n = curcpu->c_number;
+	return n < SHARDSEM_MAXCPUS ? &shs->shs_caches[n] : NULL;
+}
+
+/*
+ * Empty every CPU's cache into the pool. Call with shs_lock held, and
+ * from shardsem_P after counting ourselves in shs_waiters, which is
+ * what makes the plain load that skips empty caches safe.
+ */
+static
+void
+shardsem_drain(struct shardsem *shs)
+{
+	unsigned i, units;
+
+	for (i = 0; i < SHARDSEM_MAXCPUS; i++) {
+		if (atomic_load(&shs->shs_caches[i].sc_units) == 0) {
+			continue;
+		}
+		units = atomic_exchange(&shs->shs_caches[i].sc_units, 0);
+		if (units > 0) {
+			shs->shs_pool += units;
+			shs->shs_steals++;
+		}
+	}
+}
+
+static
+bool
+shardsem_blocked(void *arg)
+{
+	struct shardsem *shs = arg;
+
+	return atomic_load(&shs->shs_pool) == 0;
+}
+
+void
+shardsem_P(struct shardsem *shs)
+{
+	struct shardsem_cache *sc;
+	unsigned units;
+	bool wake;
+
+	KASSERT(shs != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	sc = shardsem_mycache(shs);
+	if (sc != NULL) {
+		units = atomic_load(&sc->sc_units);
+		while (units > 0) {
+			if (atomic_cas(&sc->sc_units, units, units - 1)) {
+				return;
+			}
+			units = atomic_load(&sc->sc_units);
+		}
+	}
+
+	ticketlock_acquire(&shs->shs_lock);
+	while (shs->shs_pool == 0) {
+		/*
+		 * Count ourselves before looking in the caches. The
+		 * fast path in shardsem_V adds its unit to a cache and
+		 * then looks at shs_waiters, the other way round from
+		 * us, so both sides need a full barrier in between:
+		 * the fetch-and-add here, and the one on the cache
+		 * there. Then either the drain's load of that cache
+		 * sees the unit, or that V sees us waiting and brings
+		 * the unit to the pool itself under shs_lock.
+		 */
+		atomic_fetch_add(&shs->shs_waiters, 1);
+		shardsem_drain(shs);
+		if (shs->shs_pool == 0) {
+			waittable_wait(shs, &shs->shs_lock, shardsem_blocked,
+				       shs);
+		}
+		atomic_fetch_sub(&shs->shs_waiters, 1);
+	}
+	shs->shs_pool--;
+	shs->shs_refills++;
+
+	/* Take a batch for next time, unless others need it now. */
+	if (sc != NULL && shs->shs_waiters == 0 && shs->shs_pool > 0) {
+		units = shs->shs_pool < SHARDSEM_BATCH - 1 ?
+			shs->shs_pool : SHARDSEM_BATCH - 1;
+		shs->shs_pool -= units;
+		atomic_fetch_add(&sc->sc_units, units);
+	}
+
+	/* A drain may have found more than one; pass them on. */
+	wake = shs->shs_pool > 0 && shs->shs_waiters > 0;
+	ticketlock_release(&shs->shs_lock);
+
+	if (wake) {
+		waittable_wake(shs, false);
+	}
+}
+
+void
+shardsem_V(struct shardsem *shs)
+{
+	struct shardsem_cache *sc;
+	unsigned units = 1;
+	bool wake;
+
+	KASSERT(shs != NULL);
+
+	sc = shardsem_mycache(shs);
+	if (sc != NULL && atomic_load(&shs->shs_waiters) == 0 &&
+	    atomic_load(&sc->sc_units) < SHARDSEM_CACHEMAX) {
+		atomic_fetch_add(&sc->sc_units, 1);
+		if (atomic_load(&shs->shs_waiters) == 0) {
+			return;
+		}
+		/* Somebody started waiting; the flush takes it there. */
+		units = 0;
+	}
+
+	/* Full cache, or waiters: everything goes to the pool. */
+	ticketlock_acquire(&shs->shs_lock);
+	if (sc != NULL) {
+		units += atomic_exchange(&sc->sc_units, 0);
+	}
+	shs->shs_pool += units;
+	shs->shs_flushes++;
+	wake = shs->shs_waiters > 0;
+	ticketlock_release(&shs->shs_lock);
+
+	if (wake) {
+		waittable_wake(shs, false);
+	}
+}
+
+unsigned
+shardsem_count(struct shardsem *shs)
+{
+	unsigned i, n;
+
+	n = atomic_load(&shs->shs_pool);
+	for (i = 0; i < SHARDSEM_MAXCPUS; i++) {
+		n += atomic_load(&shs->shs_caches[i].sc_units);
+	}
+	return n;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Sequence lock.
+
+struct seqlock *
+seqlock_create(const char *name)
+{
+	struct seqlock *sl;
+
+	sl = kmalloc(sizeof(*sl));
+	if (sl == NULL) {
+		return NULL;
+	}
+
+	sl->sl_name = synch_namedup(name);
+	if (sl->sl_name == NULL) {
+		kfree(sl);
+		return NULL;
+	}
+
+	ticketlock_init(&sl->sl_lock);
+	sl->sl_seq = 0;
+	synch_stats_init(&sl->sl_stats, SYNCH_KIND_SEQLOCK, sl, sl->sl_name,
+			 NULL, NULL, &sl->sl_lock);
+
+	return sl;
+}
+
+void
+seqlock_destroy(struct seqlock *sl)
+{
+	KASSERT(sl != NULL);
+	KASSERT((sl->sl_seq & 1) == 0);
+
+	synch_stats_cleanup(&sl->sl_stats);
+	ticketlock_cleanup(&sl->sl_lock);
+	synch_namefree(sl->sl_name);
+	kfree(sl);
+}
+
+void
+seqlock_write_begin(struct seqlock *sl)
+{
+	KASSERT(sl != NULL);
+
+	ticketlock_acquire(&sl->sl_lock);
+	atomic_store(&sl->sl_seq, sl->sl_seq + 1);
+	/* The odd sequence number must be visible before the data changes. */
+	atomic_fence_release();
+}
+
+void
+seqlock_write_end(struct seqlock *sl)
+{
+	KASSERT(sl != NULL);
+	KASSERT(sl->sl_seq & 1);
+
+	atomic_store_release(&sl->sl_seq, sl->sl_seq + 1);
+	ticketlock_release(&sl->sl_lock);
+}
+
+unsigned
+seqlock_read_begin(struct seqlock *sl)
+{
+	unsigned seq;
+
+	KASSERT(sl != NULL);
+
+	/*
+	 * Wait out a write in progress rather than reading data we
+	 * already know we'd have to throw away. Writers hold a spinlock,
+	 * so this never waits long.
+	 */
+	do {
+		seq = atomic_load_acquire(&sl->sl_seq);
+	} while (seq & 1);
+	return seq;
+}
+
+bool
+seqlock_read_retry(struct seqlock *sl, unsigned seq)
+{
+	KASSERT(sl != NULL);
+
+	/* Finish reading the data before looking at the sequence again. */
+	atomic_fence_acquire();
+	return atomic_load(&sl->sl_seq) != seq;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Read-copy-update.
+
+/*
+ * CPUs are tracked in 32-bit masks, so this is the most we handle.
+ */
+#define RCU_MAXCPUS 32
+#define RCU_CPUBIT(n) ((uint32_t)1 << (n))
+
+/*
+ * Read-side state. Only ever touched by its own CPU with interrupts
+ * off, so it needs no locking.
+ */
+struct rcu_cpu {
+	unsigned rc_nesting;		/* rcu_read_lock depth */
+	int rc_spl;			/* spl to restore when it hits 0 */
+};
+static struct rcu_cpu rcu_cpus[RCU_MAXCPUS];
+
+/*
+ * Grace period state. Grace periods are numbered; one is in progress
+ * whenever rcu_gp_started != rcu_gp_completed, and it ends once every
+ * CPU in rcu_pending has reported a quiescent state.
+ */
+static struct spinlock rcu_lock = SPINLOCK_INITIALIZER;
+static struct wchan *rcu_wchan;			/* synchronize_rcu sleeps here */
+static unsigned rcu_pending;			/* CPUs yet to report */
+static uint32_t rcu_online;			/* CPUs that have ever reported */
+static uint32_t rcu_idle;			/* CPUs in rcu_idle_enter */
+static unsigned rcu_gp_started;
+static unsigned rcu_gp_completed;
+static unsigned rcu_gp_wanted;			/* latest grace period asked for */
+static struct rcu_head *rcu_cbhead;		/* call_rcu callbacks, by rh_gp */
+static struct rcu_head *rcu_cbtail;
+
+static
+unsigned
+rcu_mycpu(void)
+{
+	unsigned n;
+
+	n = curcpu->c_number;
+	KASSERT(n < RCU_MAXCPUS);
+	return n;
+}
+
+void
+rcu_read_lock(void)
+{
+	struct rcu_cpu *rc;
+	int spl;
+
+	/* With interrupts off, nothing can switch us to another CPU. */
+	spl = splhigh();
+	rc = &rcu_cpus[rcu_mycpu()];
+	if (rc->rc_nesting++ == 0) {
+		rc->rc_spl = spl;
+	}
+}
+
+void
+rcu_read_unlock(void)
+{
+	struct rcu_cpu *rc;
+
+	rc = &rcu_cpus[rcu_mycpu()];
+	KASSERT(rc->rc_nesting > 0);
+	if (--rc->rc_nesting == 0) {
+		splx(rc->rc_spl);
+	}
+}
+
+/*
+ * Start a grace period if one is wanted and none is running. Every
+ * online CPU that isn't idle has to report before it ends. Call with
+ * rcu_lock held.
+ */
+static
+void
+rcu_start_gp(void)
+{
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+
+	if (rcu_gp_started != rcu_gp_completed ||
+	    rcu_gp_wanted == rcu_gp_started) {
+		return;
+	}
+	rcu_gp_started++;
+	rcu_pending = rcu_online & ~rcu_idle;
+	if (rcu_pending == 0) {
+		rcu_gp_completed = rcu_gp_started;
+	}
+}
+
+/*
+ * Note that CPU N has passed through a quiescent state, ending the
+ * grace period if it was the last one. Returns true if it did. Call
+ * with rcu_lock held.
+ */
+static
+bool
+rcu_report_qs(unsigned n)
+{
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+
+	rcu_online |= RCU_CPUBIT(n);
+	if ((rcu_pending & RCU_CPUBIT(n)) == 0) {
+		return false;
+	}
+	rcu_pending &= ~RCU_CPUBIT(n);
+	if (rcu_pending != 0) {
+		return false;
+	}
+	rcu_gp_completed = rcu_gp_started;
+	rcu_start_gp();
+	if (rcu_wchan != NULL) {
+		wchan_wakeall(rcu_wchan, &rcu_lock);
+	}
+	return true;
+}
+
+/*
+ * Ask for a grace period that starts after now, and return its number.
+ * Call with rcu_lock held.
+ */
+static
+unsigned
+rcu_want_gp(void)
+{
+	unsigned gp;
+
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+
+	gp = rcu_gp_started + 1;
+	rcu_gp_wanted = gp;
+	rcu_start_gp();
+	return gp;
+}
+
+/*
+ * Unhook the callbacks whose grace period is over. Call with rcu_lock
+ * held; run them with it released.
+ */
+static
+struct rcu_head *
+rcu_take_done(void)
+{
+	struct rcu_head *done, **pp;
+
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+
+	done = rcu_cbhead;
+	pp = &done;
+	while (*pp != NULL && (int)(rcu_gp_completed - (*pp)->rh_gp) >= 0) {
+		pp = &(*pp)->rh_next;
+	}
+	rcu_cbhead = *pp;
+	if (rcu_cbhead == NULL) {
+		rcu_cbtail = NULL;
+	}
+	*pp = NULL;
+	return done;
+}
+
+static
+void
+rcu_run_callbacks(struct rcu_head *done)
+{
+	struct rcu_head *next;
+
+	while (done != NULL) {
+		next = done->rh_next;
+		done->rh_func(done);
+		done = next;
+	}
+}
+
+void
+synchronize_rcu(void)
+{
+	struct rcu_head *done;
+	unsigned gp;
+
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rcu_cpus[rcu_mycpu()].rc_nesting == 0);
+	KASSERT(rcu_wchan != NULL);
+
+	spinlock_acquire(&rcu_lock);
+	gp = rcu_want_gp();
+	while ((int)(rcu_gp_completed - gp) < 0) {
+		/* Going to sleep reports our own CPU. */
+		wchan_sleep(rcu_wchan, &rcu_lock);
+	}
+	done = rcu_take_done();
+	spinlock_release(&rcu_lock);
+
+	rcu_run_callbacks(done);
+}
+
+void
+call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+	struct rcu_head *done;
+
+	KASSERT(head != NULL);
+	KASSERT(func != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	head->rh_func = func;
+	head->rh_next = NULL;
+
+	spinlock_acquire(&rcu_lock);
+	head->rh_gp = rcu_want_gp();
+	if (rcu_cbtail == NULL) {
+		rcu_cbhead = head;
+	}
+	else {
+		rcu_cbtail->rh_next = head;
+	}
+	rcu_cbtail = head;
+
+	/*
+	 * Callbacks are run by whichever CPU ends their grace period
+	 * (see rcu_quiescent_state), but if nobody had to report, it
+	 * has already ended.
+	 */
+	done = rcu_take_done();
+	spinlock_release(&rcu_lock);
+
+	rcu_run_callbacks(done);
+}
+
+void
+rcu_quiescent_state(void)
+{
+	struct rcu_head *done = NULL;
+	unsigned n;
+
+	n = rcu_mycpu();
+	KASSERT(rcu_cpus[n].rc_nesting == 0);
+
+	/*
+	 * This runs on every context switch, so stay off rcu_lock
+	 * unless this CPU actually owes a report. A stale read only
+	 * delays the report to the next switch.
+	 */
+	if ((atomic_load(&rcu_pending) & RCU_CPUBIT(n)) == 0 &&
+	    (rcu_online & RCU_CPUBIT(n)) != 0) {
+		return;
+	}
+
+	/* If we end a grace period, we run what was waiting for it. */
+	spinlock_acquire(&rcu_lock);
+	if (rcu_report_qs(n)) {
+		done = rcu_take_done();
+	}
+	spinlock_release(&rcu_lock);
+
+	rcu_run_callbacks(done);
+}
+
+void
+rcu_idle_enter(void)
+{
+	struct rcu_head *done = NULL;
+	unsigned n;
+
+	n = rcu_mycpu();
+	KASSERT(rcu_cpus[n].rc_nesting == 0);
+
+	/* An idle CPU can't be in a read-side section. */
+	spinlock_acquire(&rcu_lock);
+	if (rcu_report_qs(n)) {
+		done = rcu_take_done();
+	}
+	rcu_idle |= RCU_CPUBIT(n);
+	spinlock_release(&rcu_lock);
+
+	rcu_run_callbacks(done);
+}
+
+void
+rcu_idle_exit(void)
+{
+	unsigned n;
+
+	n = rcu_mycpu();
+
+	spinlock_acquire(&rcu_lock);
+	rcu_idle &= ~RCU_CPUBIT(n);
+	spinlock_release(&rcu_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Barrier.
+
+/*
+ * Barriers for fewer threads than BARRIER_TREE_MIN just count under
+ * b_lock. Past that, arrivals go through a tree with BARRIER_FANIN
+ * arrivals per node. Each node has a cache line to itself, so that
+ * arrivals at sibling nodes don't fight over one.
+ */
+#define BARRIER_TREE_MIN 8
+#define BARRIER_FANIN 4
+#define BARRIER_NOPARENT ((unsigned)-1)
+#define BARRIER_LINE 64			/* bytes per node */
+
+struct barrier_node {
+	struct ticketlock bn_lock;
+	unsigned bn_count;		/* arrivals this phase */
+	unsigned bn_expect;		/* arrivals that fill the node */
+	unsigned bn_parent;		/* index, or BARRIER_NOPARENT */
+	char bn_pad[BARRIER_LINE - sizeof(struct ticketlock) -
+		    3 * sizeof(unsigned)];
+};
+
+/*
+ * Build the combining tree: one leaf per BARRIER_FANIN threads, then
+ * one node per BARRIER_FANIN nodes on the level below, up to the root.
+ * Returns false if out of memory.
+ */
+static
+bool
+barrier_buildtree(struct barrier *b)
+{
+	unsigned level, width, n, i, total;
+
+	/* Count the nodes first. */
+	total = 0;
+	width = b->b_nthreads;
+	do {
+		width = DIVROUNDUP(width, BARRIER_FANIN);
+		total += width;
+	} while (width > 1);
+
+	b->b_nodes = kmalloc(total * sizeof(*b->b_nodes));
+	if (b->b_nodes == NULL) {
+		return false;
+	}
+	b->b_nnodes = total;
+	b->b_nleaves = DIVROUNDUP(b->b_nthreads, BARRIER_FANIN);
+
+	/*
+	 * Fill in each level. Node i of the level starting at LEVEL
+	 * takes the arrivals of children FANIN*i .. FANIN*i+FANIN-1 of
+	 * the level below, which has WIDTH entries.
+	 */
+	level = 0;
+	width = b->b_nthreads;
+	while (level < total) {
+		n = DIVROUNDUP(width, BARRIER_FANIN);
+		for (i = 0; i < n; i++) {
+			struct barrier_node *bn = &b->b_nodes[level + i];
+
+			ticketlock_init(&bn->bn_lock);
+			bn->bn_count = 0;
+			bn->bn_expect = BARRIER_FANIN;
+			if (i == n - 1 && width % BARRIER_FANIN != 0) {
+				bn->bn_expect = width % BARRIER_FANIN;
+			}
+			bn->bn_parent = (n == 1) ? BARRIER_NOPARENT :
+				level + n + i / BARRIER_FANIN;
+		}
+		level += n;
+		width = n;
+	}
+	return true;
+}
+
+struct barrier *
+barrier_create(const char *name, unsigned nthreads)
+{
+	struct barrier *b;
+
+	KASSERT(nthreads > 0);
+
+	b = kmalloc(sizeof(*b));
+	if (b == NULL) {
+		return NULL;
+	}
+
+	b->b_name = synch_namedup(name);
+	if (b->b_name == NULL) {
+		kfree(b);
+		return NULL;
+	}
+
+	b->b_nthreads = nthreads;
+	b->b_nodes = NULL;
+	b->b_nnodes = 0;
+	b->b_nleaves = 0;
+	if (nthreads >= BARRIER_TREE_MIN && !barrier_buildtree(b)) {
+		synch_namefree(b->b_name);
+		kfree(b);
+		return NULL;
+	}
+
+	ticketlock_init(&b->b_lock);
+	b->b_count = 0;
+	b->b_sense = 0;
+	synch_stats_init(&b->b_stats, SYNCH_KIND_BARRIER, b, b->b_name,
+			 NULL, NULL, &b->b_lock);
+
+	return b;
+}
+
+void
+barrier_destroy(struct barrier *b)
+{
+	unsigned i;
+
+	KASSERT(b != NULL);
+	KASSERT(b->b_count == 0);
+
+	/* Off the list first; synch_stats_print looks at the tree. */
+	synch_stats_cleanup(&b->b_stats);
+	for (i = 0; i < b->b_nnodes; i++) {
+		KASSERT(b->b_nodes[i].bn_count == 0);
+		ticketlock_cleanup(&b->b_nodes[i].bn_lock);
+	}
+	if (b->b_nodes != NULL) {
+		kfree(b->b_nodes);
+	}
+
+	ticketlock_cleanup(&b->b_lock);
+	synch_namefree(b->b_name);
+	kfree(b);
+}
+
+/*
+ * Add the counters of the combining tree's locks to the totals, for
+ * synch_stats_print.
+ */
+static
+void
+barrier_spinadd(struct barrier *b, unsigned *acquires, unsigned *contended,
+		uint64_t *rounds)
+{
+	unsigned i;
+
+	for (i = 0; i < b->b_nnodes; i++) {
+		synch_stats_spinadd(&b->b_nodes[i].bn_lock, acquires,
+				    contended, rounds);
+	}
+}
+
+/*
+ * Count one arrival at node N. Returns true if that filled it.
+ */
+static
+bool
+barrier_arrive(struct barrier *b, unsigned n)
+{
+	struct barrier_node *bn = &b->b_nodes[n];
+	bool full;
+
+	ticketlock_acquire(&bn->bn_lock);
+	KASSERT(bn->bn_count < bn->bn_expect);
+	bn->bn_count++;
+	full = (bn->bn_count == bn->bn_expect);
+	ticketlock_release(&bn->bn_lock);
+	return full;
+}
+
+/*
+ * Climb the combining tree. Returns true if we filled the root, that
+ * is, we are the last thread to arrive.
+ */
+static
+bool
+barrier_climb(struct barrier *b)
+{
+	struct barrier_node *bn;
+	unsigned start, i, n;
+	bool full = false;
+
+	/*
+	 * Start at a leaf picked by CPU to spread the arrivals out, and
+	 * move along if it's already full. There are exactly as many
+	 * leaf slots as threads, so everyone finds one.
+	 */
+	start = curcpu->c_number % b->b_nleaves;
+	for (i = 0; i < b->b_nleaves; i++) {
+		n = (start + i) % b->b_nleaves;
+		bn = &b->b_nodes[n];
+		ticketlock_acquire(&bn->bn_lock);
+		if (bn->bn_count < bn->bn_expect) {
+			bn->bn_count++;
+			full = (bn->bn_count == bn->bn_expect);
+			ticketlock_release(&bn->bn_lock);
+			break;
+		}
+		ticketlock_release(&bn->bn_lock);
+	}
+	KASSERT(i < b->b_nleaves);
+
+	/* Whoever fills a node carries the arrival up to its parent. */
+	while (full) {
+		n = b->b_nodes[n].bn_parent;
+		if (n == BARRIER_NOPARENT) {
+			return true;
+		}
+		full = barrier_arrive(b, n);
+	}
+	return false;
+}
+
+/*
+ * What a thread waiting at the barrier is waiting for: the sense to
+ * change from the one it saw when it arrived.
+ */
+struct barrier_waiter {
+	struct barrier *bw_barrier;
+	unsigned bw_sense;
+};
+
+static
+bool
+barrier_blocked(void *arg)
+{
+	struct barrier_waiter *bw = arg;
+
+	return atomic_load(&bw->bw_barrier->b_sense) == bw->bw_sense;
+}
+
+bool
+barrier_wait(struct barrier *b)
+{
+	struct barrier_waiter bw;
+	unsigned i, sense;
+	bool last;
+
+	KASSERT(b != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/* The phase can't end without us, so this can't change under us. */
+	sense = atomic_load(&b->b_sense);
+
+	if (b->b_nodes != NULL) {
+		last = barrier_climb(b);
+		if (last) {
+			/*
+			 * Everyone else is done with the tree by now, and
+			 * nobody starts on it again before seeing the new
+			 * sense, which the release store below publishes
+			 * after this.
+			 */
+			for (i = 0; i < b->b_nnodes; i++) {
+				b->b_nodes[i].bn_count = 0;
+			}
+		}
+	}
+	else {
+		ticketlock_acquire(&b->b_lock);
+		b->b_count++;
+		last = (b->b_count == b->b_nthreads);
+		if (last) {
+			b->b_count = 0;
+		}
+		ticketlock_release(&b->b_lock);
+	}
+
+	if (last) {
+		atomic_store_release(&b->b_sense, !sense);
+		waittable_wake(b, true);
+		return true;
+	}
+
+	/*
+	 * Wait for the sense to flip, with no lock of our own: the last
+	 * arriver always wakes everyone, so there's no waiter count to
+	 * keep. The acquire keeps whatever the others did before they
+	 * arrived from being read before we've seen the flip.
+	 */
+	bw.bw_barrier = b;
+	bw.bw_sense = sense;
+	waittable_wait(b, NULL, barrier_blocked, &bw);
+	atomic_fence_acquire();
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Wait group.
+
+struct waitgroup *
+waitgroup_create(const char *name)
+{
+	struct waitgroup *wg;
+
+	wg = kmalloc(sizeof(*wg));
+	if (wg == NULL) {
+		return NULL;
+	}
+
+	wg->wg_name = synch_namedup(name);
+	if (wg->wg_name == NULL) {
+		kfree(wg);
+		return NULL;
+	}
+
+	wg->wg_count = 0;
+
+	return wg;
+}
+
+void
+waitgroup_destroy(struct waitgroup *wg)
+{
+	KASSERT(wg != NULL);
+	KASSERT(wg->wg_count == 0);
+
+	synch_namefree(wg->wg_name);
+	kfree(wg);
+}
+
+void
+waitgroup_add(struct waitgroup *wg, unsigned n)
+{
+	unsigned old;
+
+	KASSERT(wg != NULL);
+
+	old = atomic_fetch_add(&wg->wg_count, n);
+	KASSERT(old + n >= old);
+	(void)old;
+}
+
+void
+waitgroup_done(struct waitgroup *wg)
+{
+	unsigned old;
+
+	KASSERT(wg != NULL);
+
+	old = atomic_fetch_sub(&wg->wg_count, 1);
+	KASSERT(old > 0);
+	if (old == 1) {
+		waittable_wake(wg, true);
+	}
+}
+
+static
+bool
+waitgroup_blocked(void *arg)
+{
+	struct waitgroup *wg = arg;
+
+	return atomic_load(&wg->wg_count) > 0;
+}
+
+void
+waitgroup_wait(struct waitgroup *wg)
+{
+	KASSERT(wg != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	/*
+	 * If everyone's already done there is nothing to wait for. The
+	 * acquire keeps the caller from reading the workers' results
+	 * before it has seen the count drop.
+	 */
+	if (atomic_load_acquire(&wg->wg_count) == 0) {
+		return;
+	}
+
+	/*
+	 * The last waitgroup_done always wakes everyone, so there is no
+	 * waiter count to keep.
+	 */
+	waittable_wait(wg, NULL, waitgroup_blocked, wg);
+	atomic_fence_acquire();
+}
+
+////////////////////////////////////////////////////////////
+//
+// Once.
+
+static
+bool
+once_blocked(void *arg)
+{
+	struct once *once = arg;
+
+	return atomic_load(&once->once_state) == ONCE_RUNNING;
+}
+
+void
+once_call(struct once *once, void (*fn)(void *), void *arg)
+{
+	KASSERT(once != NULL);
+	KASSERT(fn != NULL);
+
+	/* The acquire keeps reads of what FN set up behind the check. */
+	if (atomic_load_acquire(&once->once_state) == ONCE_DONE) {
+		return;
+	}
+
+	KASSERT(curthread->t_in_interrupt == false);
+
+	if (atomic_cas(&once->once_state, ONCE_UNINIT, ONCE_RUNNING)) {
+		fn(arg);
+		atomic_store_release(&once->once_state, ONCE_DONE);
+		/* This happens once per once, so don't bother counting. */
+		waittable_wake(once, true);
+		return;
+	}
+
+	waittable_wait(once, NULL, once_blocked, once);
+	KASSERT(atomic_load(&once->once_state) == ONCE_DONE);
+	atomic_fence_acquire();
+}
+
+////////////////////////////////////////////////////////////
+//
+// Bootstrap.
+
+void
+synch_bootstrap(void)
+{
+	waittable_bootstrap();
+
+	rcu_wchan = wchan_create("rcu");
+	if (rcu_wchan == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
 }
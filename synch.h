@@ -36,6 +36,133 @@
 
 
 #include <spinlock.h>
+#include <membar.h>
+
+/*
+ * Latency histograms.
+ *
+ * Semaphores, locks and CVs record how long each P, lock_acquire and
+ * cv_wait had to wait, and locks also how long they were held, in
+ * nanoseconds. Acquisitions that don't have to wait count as 0, and
+ * don't read the clock. Hold times are sampled: each lock measures
+ * one acquisition in SYNCH_HOLD_SAMPLE, or every one while it has a
+ * hold limit (see below), so the hold histogram counts only those.
+ *
+ * Buckets are logarithmic with SYNCH_HIST_SUB linear sub-buckets per
+ * power of two (as in HdrHistogram), so any value is known to within
+ * 1/SYNCH_HIST_SUB of itself; values of 2^SYNCH_HIST_MAXBITS ns (about
+ * 4 seconds) and up all land in the last bucket. Recording is an
+ * index computation and an increment, done under whatever already
+ * serializes the object.
+ */
+#define SYNCH_HOLD_SAMPLE	64
+#define SYNCH_HIST_SUBBITS	2
+#define SYNCH_HIST_SUB		(1 << SYNCH_HIST_SUBBITS)
+#define SYNCH_HIST_MAXBITS	32
+#define SYNCH_HIST_BUCKETS \
+	((SYNCH_HIST_MAXBITS - SYNCH_HIST_SUBBITS + 1) * SYNCH_HIST_SUB)
+
+struct synch_hist {
+	unsigned sh_count[SYNCH_HIST_BUCKETS];
+};
+
+/*
+ * Operations:
+ *    synch_hist_record     - Count one value.
+ *    synch_hist_merge      - Add the counts in SRC into DST.
+ *    synch_hist_total      - Number of values counted.
+ *    synch_hist_percentile - The value PERMILLE thousandths of the
+ *                            values are at or below (500 for the median,
+ *                            990 for p99, 999 for p99.9), rounded up to
+ *                            the top of its bucket. 0 if empty.
+ */
+void synch_hist_record(struct synch_hist *, uint64_t ns);
+void synch_hist_merge(struct synch_hist *dst, const struct synch_hist *src);
+uint64_t synch_hist_total(const struct synch_hist *);
+uint64_t synch_hist_percentile(const struct synch_hist *, unsigned permille);
+
+/*
+ * Ticket spinlocks.
+ *
+ * The semaphores, rwlocks, seqlocks, barriers and sharded semaphores
+ * keep their state under one of these rather than a plain spinlock
+ * (the cohort lock has none; it prints its handoff counts instead).
+ * The rules are the same (interrupts are off while it is held, so
+ * don't sleep), but the CPUs waiting for it get it in the order they
+ * asked, and each one backs off for a time proportional to the number
+ * of CPUs ahead of it, so that it is mostly only the next in line
+ * polling the lock word when it comes free.
+ *
+ * The holder counts acquisitions, the ones that found the lock held,
+ * and the backoff rounds spent waiting, so contention on the object's
+ * internal lock shows up in synch_stats_print (for a barrier, that is
+ * its combining tree's locks too). The wait table's buckets keep
+ * plain spinlocks, since wchan_sleep takes one.
+ */
+#define TICKETLOCK_BACKOFF	16	/* pauses per CPU ahead, per round */
+
+struct ticketlock {
+	volatile unsigned tl_next;	/* next ticket to hand out */
+	volatile unsigned tl_serving;	/* ticket of the holder */
+	struct cpu *tl_holder;
+	unsigned tl_acquires;
+	unsigned tl_contended;
+	uint64_t tl_rounds;		/* backoff rounds */
+};
+
+#define TICKETLOCK_INITIALIZER { 0, 0, NULL, 0, 0, 0 }
+
+void ticketlock_init(struct ticketlock *);
+void ticketlock_cleanup(struct ticketlock *);
+
+/*
+ * Operations:
+ *    ticketlock_acquire     - Get the lock, turning interrupts off.
+ *    ticketlock_release     - Let it go and turn interrupts back on.
+ *    ticketlock_do_i_hold   - Whether this CPU holds it.
+ */
+void ticketlock_acquire(struct ticketlock *);
+void ticketlock_release(struct ticketlock *);
+bool ticketlock_do_i_hold(struct ticketlock *);
+
+/*
+ * Every sync object is on a global list while it exists, so that the
+ * statistics of all the objects with the same name (say, one lock per
+ * vnode) can be merged and reported together. Only semaphores, locks
+ * and CVs keep histograms; for the rest the list is there for their
+ * internal ticketlocks' counters.
+ */
+#define SYNCH_KIND_SEM	0
+#define SYNCH_KIND_LOCK	1
+#define SYNCH_KIND_CV	2
+#define SYNCH_KIND_RWLOCK 3
+#define SYNCH_KIND_SEQLOCK 4
+#define SYNCH_KIND_BARRIER 5
+#define SYNCH_KIND_COHORT 6
+#define SYNCH_KIND_SHARDSEM 7
+
+struct synch_stats {
+	struct synch_stats *ss_next;	/* global list */
+	struct synch_stats *ss_prev;
+	void *ss_object;		/* the object itself */
+	const char *ss_name;		/* the object's name */
+	unsigned ss_kind;		/* SYNCH_KIND_* */
+	struct synch_hist *ss_wait;	/* time spent waiting, or NULL */
+	struct synch_hist *ss_hold;	/* time held, or NULL */
+	struct ticketlock *ss_spin;	/* internal lock, or NULL */
+	unsigned ss_holdlimit;		/* locks: hold limit in us, or 0 */
+};
+
+/*
+ * Merge the histograms of every existing object of KIND named NAME
+ * into WAIT and HOLD (HOLD may be NULL); returns how many objects
+ * there were. synch_stats_print does this for every name and prints
+ * counts and p50/p99/p999 for each, and the counters of the objects'
+ * internal ticketlocks and cohort locks' handoffs, from the kernel menu.
+ */
+unsigned synch_stats_merge(unsigned kind, const char *name,
+			   struct synch_hist *wait, struct synch_hist *hold);
+void synch_stats_print(void);
 
 /*
  * Dijkstra-style semaphore.
@@ -43,11 +170,17 @@
  * The name field is for easier debugging. A copy of the name is made
  * internally.
  */
+struct sem_anylink;
+
 struct semaphore {
 	char *sem_name;
-	struct wchan *sem_wchan;
-	struct spinlock sem_lock;
-	volatile unsigned sem_count;
+	struct ticketlock sem_lock;	/* protects everything below */
+	unsigned sem_count;
+	unsigned sem_waiters;		/* threads asleep in P */
+	unsigned sem_allwaiters;	/* threads in sem_wait_all */
+	struct sem_anylink *sem_anywaiters;	/* threads in sem_wait_any */
+	struct synch_stats sem_stats;
+	struct synch_hist sem_waithist;	/* time in P */
 };
 
 struct semaphore *sem_create(const char *name, unsigned initial_count);
@@ -62,6 +195,28 @@ void sem_destroy(struct semaphore *);
 void P(struct semaphore *);
 void V(struct semaphore *);
 
+/*
+ * P on whichever of N semaphores comes available first, and return
+ * its index in SEMS. Exactly one of them is decremented. If none can
+ * be decremented right away, sleep until a V on any of them; that V
+ * hands its unit straight to us rather than to threads waiting in P.
+ * N may be at most SEM_WAITANY_MAX.
+ */
+#define SEM_WAITANY_MAX 16
+
+unsigned sem_wait_any(struct semaphore **sems, unsigned n);
+
+/*
+ * Decrement each of N distinct semaphores SEMS[i] by COUNTS[i], all at
+ * once: either every decrement happens or none does. Sleeps until all
+ * of them can be done together, and never holds any units while
+ * asleep. N may be at most SEM_WAITALL_MAX.
+ */
+#define SEM_WAITALL_MAX 16
+
+void sem_wait_all(struct semaphore **sems, const unsigned *counts,
+		  unsigned n);
+
 
 /*
  * Simple lock for mutual exclusion.
@@ -76,17 +231,29 @@ struct lock {
         
 	char *lk_name;
 	
-	//the lock needs a waiting channel to block threads
-	struct wchan *lock_wchan;
-	
-	//the spinlock is used to make certain sections critical and
-	//is also used by the waiting channel
-	struct spinlock lock_lock;
+	//number of threads waiting for the lock; they sleep in the
+	//global wait table instead of on a waiting channel of our own
+	unsigned lock_waiters;
 	
 	//use a thread pointer to point to the thread that
-	//is currently holding the lock
-	volatile struct thread *holding_thread; 
+	//is currently holding the lock; it is only changed with
+	//the atomic operations in atomic.h
+	struct thread *holding_thread; 
         
+	//wait and hold time statistics; lk_acquired is when the
+	//current holder got the lock, if its hold time is being
+	//sampled, lk_holdsample counts acquisitions towards the next
+	//sample, and only the holder touches any of these
+	struct synch_stats lk_stats;
+	struct synch_hist lk_waithist;
+	struct synch_hist lk_holdhist;
+	uint64_t lk_acquired;
+	unsigned lk_holdsample;
+	
+	//where the current holder called lock_acquire from, for the
+	//hold-time watchdog
+	const void *lk_acqsite;
+
 
 	HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
 };
@@ -126,8 +293,18 @@ bool lock_do_i_hold(struct lock *);
 
 struct cv {
         char *cv_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+        
+	//bumped by every signal and broadcast; a waiter sleeps until
+	//it moves on from the value it saw before letting go of the lock
+	unsigned cv_seq;
+	
+	//number of threads in cv_wait, so signals with nobody to wake
+	//never touch the wait table
+	unsigned cv_waiters;
+	
+	//time spent in cv_wait; recorded with the lock held again
+	struct synch_stats cv_stats;
+	struct synch_hist cv_waithist;
 };
 
 struct cv *cv_create(const char *name);
@@ -162,8 +339,14 @@ void cv_broadcast(struct cv *cv, struct lock *lock);
 
 struct rwlock {
         char *rwlock_name;
-        // add what you need here
-        // (don't forget to mark things volatile as needed)
+	struct ticketlock rw_lock;	/* protects everything below */
+	unsigned rw_readers;		/* plain readers holding the lock */
+	unsigned rw_readers_waiting;	/* incl. upgradable readers */
+	unsigned rw_writers_waiting;
+	struct thread *rw_writer;
+	struct thread *rw_upgrader;	/* upgradable reader, if any */
+	bool rw_upgrading;		/* rw_upgrader is becoming writer */
+	struct synch_stats rw_stats;
 };
 
 struct rwlock * rwlock_create(const char *);
@@ -177,6 +360,18 @@ void rwlock_destroy(struct rwlock *);
  *    rwlock_acquire_write - Get the lock for writing. Only one thread can
  *                           hold the write lock at one time.
  *    rwlock_release_write - Free the write lock.
+ *    rwlock_acquire_upgrade - Get the lock for upgradable reading. Plain
+ *                           readers can share the lock with the upgradable
+ *                           reader, but only one thread can hold it in this
+ *                           mode, and writers are kept out.
+ *    rwlock_release_upgrade - Free an upgradable read lock.
+ *    rwlock_upgrade       - Turn the caller's upgradable read lock into the
+ *                           write lock, waiting for plain readers to drain.
+ *                           This cannot fail: nobody else can be upgrading.
+ *    rwlock_downgrade     - Turn the caller's write lock into a read lock
+ *                           without releasing it, and wake queued readers.
+ *
+ * Waiting writers hold back new readers, so readers cannot starve them.
  *
  * These operations must be atomic. You get to write them.
  */
@@ -185,5 +380,559 @@ void rwlock_acquire_read(struct rwlock *);
 void rwlock_release_read(struct rwlock *);
 void rwlock_acquire_write(struct rwlock *);
 void rwlock_release_write(struct rwlock *);
+void rwlock_acquire_upgrade(struct rwlock *);
+void rwlock_release_upgrade(struct rwlock *);
+void rwlock_upgrade(struct rwlock *);
+void rwlock_downgrade(struct rwlock *);
+
+/*
+ * CPU clusters.
+ *
+ * CPUs that share a cache or a socket make up a cluster. The kernel
+ * doesn't know the machine's layout, so every CPU starts out in
+ * cluster 0 until platform code says otherwise; in the host build the
+ * topology shim in host/shim.c does, from HOST_CLUSTERS.
+ *
+ *    synch_cluster_set - Put CPU number CPU in cluster CLUSTER, which
+ *                        must be less than SYNCH_MAXCLUSTERS.
+ *    synch_cluster     - The cluster CPU number CPU is in.
+ */
+#define SYNCH_MAXCLUSTERS	8
+#define SYNCH_CLUSTER_MAXCPUS	32	/* higher CPUs are in cluster 0 */
+
+void synch_cluster_set(unsigned cpu, unsigned cluster);
+unsigned synch_cluster(unsigned cpu);
+
+/*
+ * Wakeup placement.
+ *
+ * A thread woken out of the wait table (by V, lock_release, or any
+ * other primitive's wakeup) runs wherever the scheduler puts it. With
+ * wake affinity on, the waker chooses, for each thread it wakes that
+ * was waiting on the same object: the CPU it went to sleep on, where
+ * its own working set is still cached, if it slept less than
+ * SYNCH_WAKE_HOTNS or that CPU is in the waker's cluster; otherwise,
+ * its cache having gone cold anyway, the waker's CPU, where the data
+ * the wakeup is about was last touched.
+ *
+ * Which CPU a thread is on and how to make a woken thread run on a
+ * given one are up to platform code, which registers both with
+ * synch_wake_placer; the CPU numbers are the ones synch_cluster takes.
+ * The waker calls PLACE right after the wakeup, with no spinlocks
+ * held, and the woken thread doesn't get out of its wait until it
+ * returns. The choice holds for the one wakeup; it is not a permanent
+ * binding. By default the CPU is curcpu's number and nothing is
+ * placed: in the kernel, thread_make_runnable already puts a woken
+ * thread back on its last CPU (a placer would move it to another
+ * CPU's run queue), so there the switch only changes what is counted. The host build's topology shim places
+ * threads by processor affinity, when it has a topology.
+ *
+ * Wakeups that leave a thread on a different CPU from the one it
+ * slept on are counted as migrations, per CPU, whether or not wake
+ * affinity is on, as long as instrumentation is; synch_stats_print
+ * reports them with the rest.
+ *
+ * Operations:
+ *    synch_wakeaffine_set - Turn wake affinity on or off. It starts
+ *                           out off.
+ *    synch_wakeaffine_get - Whether it is on.
+ *    synch_wake_placer    - Use WHERE to find out the calling
+ *                           thread's CPU and PLACE (which may be NULL)
+ *                           to have a thread about to be woken run on
+ *                           a given one. Call once, before other
+ *                           threads start.
+ *    synch_wake_stats     - Add up the counts from all CPUs.
+ */
+#define SYNCH_WAKE_HOTNS	200000	/* 200 us */
+
+struct synch_wakestats {
+	unsigned sw_wakeups;		/* woken out of the wait table */
+	unsigned sw_migrated;		/* ...onto another CPU */
+	unsigned sw_tolast;		/* placed back where they slept */
+	unsigned sw_towaker;		/* placed on the waker's CPU */
+};
+
+void synch_wakeaffine_set(bool on);
+bool synch_wakeaffine_get(void);
+void synch_wake_placer(unsigned (*where)(void),
+		       void (*place)(struct thread *t, unsigned cpu));
+void synch_wake_stats(struct synch_wakestats *sw);
+
+/*
+ * Cohort lock.
+ *
+ * A lock for mutual exclusion, like struct lock, for machines where
+ * passing a lock (and the data it protects) between clusters costs
+ * much more than passing it within one. It is made of two locks: a
+ * local lock per cluster, each in a cache line of its own, and one
+ * global lock. A thread takes its cluster's local lock and then, unless
+ * the cluster already has it, the global one.
+ *
+ * On release, if another thread in the same cluster is waiting for the
+ * local lock, the global lock stays with the cluster and only the local
+ * lock is let go, so the next holder never touches the global lock's
+ * cache line. After COHORT_BATCH such handoffs in a row, if another
+ * cluster is waiting, the global lock is let go too. The global lock is
+ * a ticket lock, taken by at most one thread per cluster at a time, so
+ * clusters get it in the order they asked and none starves.
+ *
+ * cc_local and cc_remote count, per cluster, the handoffs that kept
+ * the global lock and the releases of it to a waiting cluster; see
+ * cohortlock_handoffs. With every CPU in one cluster it is a plain
+ * sleeping lock that takes the global lock once per batch.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+#define COHORT_BATCH	16
+#define COHORT_LINE	64	/* bytes per cluster */
+
+struct cohort_cluster {
+	unsigned cc_locked;		/* the local lock; also a wait key */
+	unsigned cc_waiters;		/* threads asleep on cc_locked */
+	unsigned cc_global;		/* holds the global lock */
+	unsigned cc_batch;		/* local handoffs in a row */
+	struct thread *cc_holder;
+	unsigned cc_local;
+	unsigned cc_remote;
+	char cc_pad[COHORT_LINE - 6 * sizeof(unsigned) -
+		    sizeof(struct thread *)];
+};
+
+struct cohortlock {
+	struct cohort_cluster ck_clusters[SYNCH_MAXCLUSTERS];
+	/* The global lock, only touched once per batch. */
+	unsigned ck_next;		/* next ticket to hand out */
+	unsigned ck_serving;		/* holder's ticket; also a wait key */
+	unsigned ck_waiters;		/* threads asleep on ck_serving */
+	unsigned ck_owner;		/* cluster holding it */
+	char *ck_name;
+	struct synch_stats ck_stats;
+};
+
+struct cohortlock *cohortlock_create(const char *name);
+void cohortlock_destroy(struct cohortlock *);
+
+/*
+ * Operations:
+ *    cohortlock_acquire    - Get the lock.
+ *    cohortlock_release    - Free the lock, passing it on as above.
+ *    cohortlock_do_i_hold  - Whether the current thread holds it.
+ *    cohortlock_handoffs   - Add up the per-cluster handoff counts.
+ */
+void cohortlock_acquire(struct cohortlock *);
+void cohortlock_release(struct cohortlock *);
+bool cohortlock_do_i_hold(struct cohortlock *);
+void cohortlock_handoffs(struct cohortlock *, unsigned *local,
+			 unsigned *remote);
+
+/*
+ * Sharded counting semaphore.
+ *
+ * A semaphore for a pool of interchangeable resources that every CPU
+ * takes from and gives back to at a high rate. Each CPU keeps a cache
+ * of units of its own, in a cache line of its own, and P and V use
+ * that without writing anything another CPU is using. Only when its
+ * cache is empty does a CPU go to the shared pool, taking up to
+ * SHARDSEM_BATCH units at once, and only when it has more than
+ * SHARDSEM_CACHEMAX does it give them back.
+ *
+ * The count is still exact: a P only sleeps once every cache has been
+ * emptied into the pool and the pool is empty, and while anyone is
+ * asleep, V puts units straight into the pool. shs_refills,
+ * shs_flushes and shs_steals count trips to the pool to take units,
+ * to give them back, and to take them from other CPUs' caches.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+#define SHARDSEM_MAXCPUS	32	/* higher CPUs use the pool directly */
+#define SHARDSEM_BATCH		8
+#define SHARDSEM_CACHEMAX	16
+#define SHARDSEM_LINE		64	/* bytes per cache */
+
+struct shardsem_cache {
+	volatile unsigned sc_units;
+	char sc_pad[SHARDSEM_LINE - sizeof(unsigned)];
+};
+
+struct shardsem {
+	struct shardsem_cache shs_caches[SHARDSEM_MAXCPUS];
+	char *shs_name;
+	struct ticketlock shs_lock;	/* protects everything below */
+	unsigned shs_pool;
+	unsigned shs_waiters;		/* threads asleep in shardsem_P */
+	unsigned shs_refills;
+	unsigned shs_flushes;
+	unsigned shs_steals;
+	struct synch_stats shs_stats;
+};
+
+struct shardsem *shardsem_create(const char *name, unsigned initial_count);
+void shardsem_destroy(struct shardsem *);
+
+/*
+ * Operations:
+ *    shardsem_P     - Take a unit, waiting for one if there are none.
+ *    shardsem_V     - Give a unit back.
+ *    shardsem_count - Units free, in the pool and the caches. Only a
+ *                     snapshot unless the caller somehow stops P and V.
+ */
+void shardsem_P(struct shardsem *);
+void shardsem_V(struct shardsem *);
+unsigned shardsem_count(struct shardsem *);
+
+/*
+ * Sequence lock.
+ *
+ * For small, read-mostly data such as timestamps and counters. Writers
+ * serialize on a spinlock and bump the sequence number before and after
+ * each update, so it is odd while an update is in progress. Readers
+ * never write shared memory: they sample the sequence number, copy the
+ * data, and try again if the number moved in the meantime:
+ *
+ *     do {
+ *             seq = seqlock_read_begin(sl);
+ *             copy = shared;
+ *     } while (seqlock_read_retry(sl, seq));
+ *
+ * A reader may see a torn copy before seqlock_read_retry says it is
+ * good, so it must not follow pointers or act on it until then.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct seqlock {
+	char *sl_name;
+	struct ticketlock sl_lock;	/* serializes writers */
+	unsigned sl_seq;		/* odd while a write is in progress */
+	struct synch_stats sl_stats;
+};
+
+struct seqlock *seqlock_create(const char *name);
+void seqlock_destroy(struct seqlock *);
+
+/*
+ * Operations:
+ *    seqlock_write_begin - Start an update. Writers exclude each other
+ *                          and may not sleep until seqlock_write_end.
+ *    seqlock_write_end   - Finish an update.
+ *    seqlock_read_begin  - Start a read; returns the sequence number to
+ *                          pass to seqlock_read_retry.
+ *    seqlock_read_retry  - Return true if a write overlapped the read
+ *                          and it must be done again.
+ */
+void seqlock_write_begin(struct seqlock *);
+void seqlock_write_end(struct seqlock *);
+unsigned seqlock_read_begin(struct seqlock *);
+bool seqlock_read_retry(struct seqlock *, unsigned seq);
+
+/*
+ * Read-copy-update.
+ *
+ * For read-mostly linked structures. Readers bracket their traversal
+ * with rcu_read_lock/rcu_read_unlock, which only disable interrupts on
+ * the current CPU: no shared memory is written and no atomic operations
+ * are done. Writers publish new versions with rcu_assign_pointer and
+ * must not free an old version until every reader that might still see
+ * it is done, either by waiting in synchronize_rcu or by handing it to
+ * call_rcu, which runs the callback once that is true.
+ *
+ * A CPU cannot switch threads inside a read-side section, so once every
+ * CPU has switched threads (or gone idle) since an update, all readers
+ * that could have seen the old version are gone. That is a grace
+ * period. For this to work, thread_switch and thread_startup must call
+ * rcu_quiescent_state once the run queue lock has been dropped, and the
+ * idle loop must bracket cpu_idle with rcu_idle_enter/rcu_idle_exit.
+ *
+ * Whichever CPU reports last runs the callbacks whose grace period it
+ * ended, from one of those hooks, so they are run even if nothing
+ * calls into RCU again. Callbacks must therefore not sleep.
+ *
+ * Readers may not sleep. Writers still have to exclude each other with
+ * some other lock.
+ */
+struct rcu_head {
+	struct rcu_head *rh_next;
+	void (*rh_func)(struct rcu_head *);
+	unsigned rh_gp;			/* grace period to wait for */
+};
+
+#define rcu_assign_pointer(p, v) \
+	do { membar_store_store(); (p) = (v); } while (0)
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void synchronize_rcu(void);
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *));
+
+void rcu_quiescent_state(void);
+void rcu_idle_enter(void);
+void rcu_idle_exit(void);
+
+/*
+ * Barrier.
+ *
+ * A fixed number of threads meet at the barrier; none of them gets
+ * past until all of them have arrived. The barrier resets itself, so
+ * the same threads can use it again for the next phase.
+ *
+ * Small barriers count arrivals under one spinlock. Barriers for more
+ * threads count them in a combining tree instead, so that arrivals
+ * mostly hit different leaf locks and only one thread per node goes
+ * further up. Either way the threads that aren't last wait for the
+ * sense word to flip without taking any lock, and the last thread to
+ * arrive flips it and wakes all the others with a single wakeup.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct barrier_node;
+
+struct barrier {
+	char *b_name;
+	struct ticketlock b_lock;	/* protects b_count */
+	unsigned b_nthreads;
+	unsigned b_count;		/* arrivals, without a tree */
+	unsigned b_sense;		/* flips every phase; atomic */
+	struct barrier_node *b_nodes;	/* combining tree, or NULL */
+	unsigned b_nnodes;
+	unsigned b_nleaves;		/* leaves come first in b_nodes */
+	struct synch_stats b_stats;
+};
+
+struct barrier *barrier_create(const char *name, unsigned nthreads);
+void barrier_destroy(struct barrier *);
+
+/*
+ * Operations:
+ *    barrier_wait - Arrive at the barrier and wait for the others.
+ *                   Returns true in exactly one of the threads (the
+ *                   last to arrive) and false in the rest.
+ */
+bool barrier_wait(struct barrier *);
+
+/*
+ * Wait group (countdown latch).
+ *
+ * For fork-join: the parent adds one to the count for each worker it
+ * launches, each worker calls waitgroup_done when it finishes, and the
+ * parent waits for the count to drop to zero. Only the last
+ * waitgroup_done wakes anyone up.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct waitgroup {
+	char *wg_name;
+	unsigned wg_count;		/* only changed atomically */
+};
+
+struct waitgroup *waitgroup_create(const char *name);
+void waitgroup_destroy(struct waitgroup *);
+
+/*
+ * Operations:
+ *    waitgroup_add  - Add N to the count.
+ *    waitgroup_done - Take one off the count, waking the waiters if it
+ *                     hits zero. The count must not already be zero.
+ *    waitgroup_wait - Wait for the count to be zero. Returns at once if
+ *                     it already is.
+ */
+void waitgroup_add(struct waitgroup *, unsigned n);
+void waitgroup_done(struct waitgroup *);
+void waitgroup_wait(struct waitgroup *);
+
+/*
+ * One-time initialization.
+ *
+ * once_call runs FN(ARG) the first time it's called on a given once,
+ * and never again. Callers that arrive while FN is running sleep until
+ * it finishes, so once_call never returns before the initialization is
+ * done. After that, once_call is just a load and a read barrier.
+ *
+ * Declare with ONCE_INITIALIZER:
+ *
+ *     static struct once foo_once = ONCE_INITIALIZER;
+ *     ...
+ *     once_call(&foo_once, foo_init, NULL);
+ *
+ * Callers that may have to wait need synch_bootstrap to have run.
+ */
+struct once {
+	unsigned once_state;		/* only changed atomically */
+};
+
+#define ONCE_UNINIT	0
+#define ONCE_RUNNING	1
+#define ONCE_DONE	2
+
+#define ONCE_INITIALIZER { ONCE_UNINIT }
+
+void once_call(struct once *, void (*fn)(void *), void *arg);
+
+/*
+ * Event tracing.
+ *
+ * While tracing is on, semaphores, locks, CVs and rwlocks log what
+ * they do into a ring buffer per CPU. Each CPU only writes its own
+ * ring, with interrupts off, so no locks are taken. When a ring fills
+ * up the oldest records are overwritten.
+ *
+ * Records are fixed-size and written to the dump file as is, in the
+ * kernel's byte order, after a header:
+ *
+ *     struct synch_trace_header
+ *     struct synch_trace_rec * sth_nrecs, each CPU's oldest first
+ *
+ * tr_object is the object, or for SLEEP, WAKEUP and WAKE the wait
+ * table key, which is the object or an address inside it; tr_thread is
+ * the thread. Both are addresses, cut to 32 bits. For WAKE, tr_arg is 1
+ * for a wake-all and 0 otherwise. For the other events that are about
+ * an object, tr_arg is SYNCH_TR_ARG(kind, flag): the object's
+ * SYNCH_KIND_* and a flag that is 1 for a write (rwlock) or a
+ * broadcast (SIGNAL). SLEEP and WAKEUP have 0. An upgradable read
+ * hold is traced as a read. rwlock_upgrade and rwlock_downgrade are
+ * traced as a RELEASE or HANDOFF of the old mode, then (CONTEND and)
+ * ACQUIRE of the new one, all with 2 added to the flag, which
+ * SYNCH_TR_MODE picks out: one hold closes and the other opens
+ * without any other thread acquiring the lock in between.
+ *
+ * Together, the ACQUIRE and RELEASE/HANDOFF records of each thread
+ * give its whole sequence of critical sections: which object, for
+ * how long, and how long it ran between them.
+ *
+ * host/tracedecode.c turns a dump back into per-object timelines, and
+ * host/tracereplay.c plays those critical sections back against the
+ * primitives.
+ */
+#define SYNCH_TRACE_MAGIC	0x53595452	/* "SYTR" */
+#define SYNCH_TRACE_VERSION	2
+
+#define SYNCH_TR_ARG(kind, flag)	(((kind) << 8) | (flag))
+#define SYNCH_TR_KIND(arg)		(((arg) >> 8) & 0xff)
+#define SYNCH_TR_FLAG(arg)		((arg) & 1)
+#define SYNCH_TR_MODE(arg)		(((arg) >> 1) & 1)
+
+#define SYNCH_TR_CONTEND	1	/* found it taken; will wait */
+#define SYNCH_TR_SLEEP		2	/* going to sleep on a key */
+#define SYNCH_TR_WAKEUP		3	/* woken up on a key */
+#define SYNCH_TR_ACQUIRE	4	/* got it (P, acquire, cv_wait done) */
+#define SYNCH_TR_HANDOFF	5	/* gave it up, waking a waiter */
+#define SYNCH_TR_RELEASE	6	/* gave it up, nobody waiting */
+#define SYNCH_TR_WAKE		7	/* woke sleepers on a key */
+#define SYNCH_TR_SIGNAL		8	/* cv_signal, cv_broadcast */
+
+struct synch_trace_header {
+	uint32_t sth_magic;		/* SYNCH_TRACE_MAGIC */
+	uint16_t sth_version;		/* SYNCH_TRACE_VERSION */
+	uint16_t sth_recsize;		/* sizeof(struct synch_trace_rec) */
+	uint32_t sth_nrecs;
+	uint32_t sth_dropped;		/* overwritten before the dump */
+};
+
+struct synch_trace_rec {
+	uint64_t tr_time;		/* nanoseconds */
+	uint32_t tr_object;
+	uint32_t tr_thread;
+	uint16_t tr_cpu;
+	uint16_t tr_event;		/* SYNCH_TR_* */
+	uint32_t tr_arg;
+};
+
+/*
+ * Operations:
+ *    synch_trace_start - Throw away anything traced so far and start
+ *                        tracing, keeping up to NRECS records per CPU.
+ *    synch_trace_stop  - Stop tracing. Returns once no CPU is still in
+ *                        the middle of writing a record.
+ *    synch_trace_dump  - Stop tracing and write what's in the rings to
+ *                        the file PATH. Returns an errno value.
+ */
+int synch_trace_start(unsigned nrecs);
+void synch_trace_stop(void);
+int synch_trace_dump(const char *path);
+
+/*
+ * Contention call sites.
+ *
+ * Whenever P, lock_acquire or one of the rwlock acquires has to wait,
+ * the caller's return address is charged with one contended
+ * acquisition and the time it waited, per object and call site, in a
+ * fixed-size table. That says which code paths fight over a lock that
+ * many of them share. Once the table is full, new (object, site)
+ * pairs are only counted as dropped.
+ *
+ * synch_callsite_print lists the table, most total wait first, from
+ * the kernel menu. Sites are printed as addresses; turn them into
+ * functions and lines with os161-addr2line -f -e kernel (or plain
+ * addr2line for the host build).
+ */
+#define SYNCH_CALLSITE_SIZE	256	/* power of 2 */
+
+void synch_callsite_print(void);
+void synch_callsite_reset(void);
+
+/*
+ * Hold-time watchdog.
+ *
+ * Each class of locks (all the locks with one name) can be given a
+ * limit on how long it should be held. lock_release checks the hold
+ * time against the limit, and if it was over, logs the lock, the
+ * thread, where it called lock_acquire from and how long it held the
+ * lock in a ring of the last SYNCH_HOLDLOG_SIZE offenders.
+ *
+ * A lock that is never released never gets to that check, so the
+ * watchdog thread also looks every so often for locks that are held
+ * past their limit right now and reports them on the console. Its
+ * view of who holds what is unlocked and so only approximate.
+ *
+ * Operations:
+ *    synch_holdlimit_set   - Set the hold limit of locks named NAME,
+ *                            existing and future, to US microseconds;
+ *                            0 removes it. Up to SYNCH_HOLDLIMIT_MAX
+ *                            names can have limits. Returns an errno
+ *                            value.
+ *    synch_holdlimit_print - Print the limits and the offender log.
+ *    synch_watchdog_start  - Start the watchdog thread, scanning every
+ *                            PERIOD seconds, or change the period if
+ *                            it is already running. Returns an errno
+ *                            value.
+ *    synch_watchdog_stop   - Stop it; it goes away after its next scan.
+ */
+#define SYNCH_HOLDLIMIT_MAX	16
+#define SYNCH_HOLDLOG_SIZE	32
+
+int synch_holdlimit_set(const char *name, unsigned us);
+void synch_holdlimit_print(void);
+int synch_watchdog_start(unsigned period);
+void synch_watchdog_stop(void);
+
+/*
+ * Instrumentation switch.
+ *
+ * The histograms, call sites, hold limits and tracing all sit behind
+ * one flag. While it is off, each hook in the primitives costs a load
+ * of the flag, which is almost never written and so stays in every
+ * CPU's cache, and a branch that always goes the same way. Tracing
+ * also has to be started with synch_trace_start.
+ *
+ * It starts out on. In the lean build (see synch.c) only tracing is
+ * left for it to switch. Waits and hold times that began while it was
+ * off are not measured.
+ *
+ * Operations:
+ *    synch_instrument_set - Turn all instrumentation on or off.
+ *    synch_instrument_get - Whether it is on.
+ */
+void synch_instrument_set(bool on);
+bool synch_instrument_get(void);
+
+/*
+ * Set up the global state behind the primitives above, including the
+ * wait table every primitive sleeps in. Call once, early in boot(),
+ * before any thread can block and before the other CPUs are started.
+ */
+void synch_bootstrap(void);
 
 #endif /* _SYNCH_H_ */
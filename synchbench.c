@@ -0,0 +1,887 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Microbenchmarks for the synchronization primitives.
+ *
+ * For each of semaphore, lock, cv, rwlock, seqlock, cohort lock and
+ * sharded semaphore, measures:
+ *
+ *    uncontended - one thread, back to back: P/V, acquire/release,
+ *                  signal with nobody waiting, read and write
+ *                  acquire/release. Reported per operation.
+ *    contended   - 1..N threads hammering one object, each holding it
+ *                  for a configurable critical section (a busy loop
+ *                  of CSLEN iterations). For the rwlock, READPCT percent
+ *                  of the acquisitions are reads, and likewise for the
+ *                  seqlock, whose reads (begin, copy, retry if a write
+ *                  overlapped) can be compared with the rwlock's read
+ *                  acquire/release. For the cv, threads
+ *                  pass a token around a ring, each waiting on the cv
+ *                  for its turn. The sharded semaphore starts with
+ *                  SB_MAXTHREADS units, so nobody waits for one: it is
+ *                  the P/V rate on a shared pool being measured.
+ *                  Reported as operations per second.
+ *    handoff     - time from one thread giving the object up (V,
+ *                  release, signal, write release) to a thread that was
+ *                  asleep waiting for it coming out of the wait.
+ *                  Seqlock readers never wait, so it has none.
+ *
+ * Output is CSV, one row per measurement, so runs can be compared
+ * across changes.
+ *
+ * Usage (kernel menu or host build):
+ *
+ *    sb [prim [maxthreads [iters [cslen [readpct [instr [wake]]]]]]]
+ *
+ * PRIM is sem, lock, cv, rwlock, seqlock, cohort, shardsem or all.
+ * INSTR, if given, turns the instrumentation switch
+ * (synch_instrument_set) off (0) or on (1) for the run, to measure
+ * what the hooks cost; otherwise it is left as is. WAKE does the same for wake affinity
+ * (synch_wakeaffine_set). Each row says how many wakeups during it,
+ * the benchmark's own few included, left a thread on another CPU, and
+ * for the cohort lock how many times it was passed on within a cluster
+ * (local) and to another cluster (remote); run it with HOST_CLUSTERS
+ * set on the host to see the difference.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <atomic.h>
+#include <test.h>
+
+#define SB_MAXTHREADS	24	/* contended runs go up to this many */
+#define SB_HANDOFFS	1000	/* handoffs timed per primitive */
+
+/* Defaults for the arguments. */
+#define SB_THREADS	8
+#define SB_ITERS	100000
+#define SB_CSLEN	0
+#define SB_READPCT	90
+
+struct sbconfig {
+	unsigned sc_maxthreads;
+	unsigned sc_iters;		/* operations per thread */
+	unsigned sc_cslen;		/* busy loop inside the section */
+	unsigned sc_readpct;		/* rwlock/seqlock reads, percent */
+	int sc_instr;			/* instrumentation, or -1 as is */
+	int sc_wake;			/* wake affinity, or -1 as is */
+};
+
+static struct sbconfig sb_config;
+static unsigned sb_migrated;		/* wake migrations before this row */
+static unsigned sb_local, sb_remote;	/* cohort handoffs before it */
+
+static struct semaphore *sb_sem;
+static struct lock *sb_lock;
+static struct cv *sb_cv;
+static struct rwlock *sb_rw;
+static struct seqlock *sb_sl;
+static struct cohortlock *sb_ck;
+static struct shardsem *sb_shs;
+
+static struct barrier *sb_start;	/* workers and the main thread */
+static struct waitgroup *sb_done;
+
+/*
+ * When each worker started and finished. A run lasts from the first
+ * start to the last finish.
+ */
+static struct timespec sb_starts[SB_MAXTHREADS];
+static struct timespec sb_ends[SB_MAXTHREADS];
+
+/* Token for the cv ring, protected by sb_lock. */
+static unsigned sb_turn;
+static unsigned sb_nthreads;
+
+/* Data behind the seqlock; the writer keeps both words equal. */
+static unsigned sb_seqdata[2];
+
+/* Handoff timing. */
+static volatile unsigned sb_round;
+static struct timespec sb_stamp;
+static uint64_t sb_handoff_ns;
+
+////////////////////////////////////////////////////////////
+// utilities
+
+static
+uint64_t
+sb_ns(const struct timespec *start, const struct timespec *end)
+{
+	struct timespec diff;
+
+	timespec_sub(end, start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+}
+
+/*
+ * Critical section work. The volatile keeps it from being optimized
+ * into nothing.
+ */
+static
+void
+sb_spin(unsigned n)
+{
+	volatile unsigned i;
+
+	for (i = 0; i < n; i++) {
+		/* nothing */
+	}
+}
+
+/*
+ * Cheap per-thread pseudo-random numbers, for the read/write mix.
+ */
+static
+unsigned
+sb_random(unsigned *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+static
+void
+sb_header(void)
+{
+	struct synch_wakestats sw;
+
+	kprintf("prim,test,threads,cslen,readpct,instr,wake,ops,ns,"
+		"ns_per_op,ops_per_sec,migrated,local,remote\n");
+	synch_wake_stats(&sw);
+	sb_migrated = sw.sw_migrated;
+	sb_local = sb_remote = 0;
+	cohortlock_handoffs(sb_ck, &sb_local, &sb_remote);
+}
+
+static
+void
+sb_row(const char *prim, const char *test, unsigned threads,
+       uint64_t ops, uint64_t ns)
+{
+	struct synch_wakestats sw;
+	unsigned local = 0, remote = 0;
+
+	if (ns == 0) {
+		ns = 1;
+	}
+	synch_wake_stats(&sw);
+	cohortlock_handoffs(sb_ck, &local, &remote);
+	kprintf("%s,%s,%u,%u,%u,%d,%d,%llu,%llu,%llu,%llu,%u,%u,%u\n",
+		prim, test, threads, sb_config.sc_cslen,
+		sb_config.sc_readpct, synch_instrument_get(),
+		synch_wakeaffine_get(),
+		(unsigned long long)ops, (unsigned long long)ns,
+		(unsigned long long)(ns / (ops ? ops : 1)),
+		(unsigned long long)(ops * 1000000000 / ns),
+		sw.sw_migrated - sb_migrated, local - sb_local,
+		remote - sb_remote);
+	sb_migrated = sw.sw_migrated;
+	sb_local = local;
+	sb_remote = remote;
+}
+
+////////////////////////////////////////////////////////////
+// primitives
+
+/*
+ * What each primitive looks like to the benchmark. "Enter" is
+ * P/acquire and "leave" is V/release, with WRITE picking the rwlock
+ * mode; for the cv they wait for and set a flag. For a lock the thread
+ * that enters holds it until it leaves (SP_OWNED); a semaphore or cv
+ * handoff is one-way. Primitives with no SP_WAITERS have no handoff
+ * test.
+ */
+struct sbprim {
+	const char *sp_name;
+	void (*sp_uncontended)(unsigned iters);
+	void (*sp_contended)(void *, unsigned long);	/* thread */
+	void (*sp_enter)(bool write);
+	void (*sp_leave)(bool write);
+	unsigned (*sp_waiters)(void);	/* threads asleep in enter */
+	bool sp_owned;
+	unsigned sp_uncontended_ops;	/* per iteration */
+};
+
+static void sb_contended_thread(void *, unsigned long);
+static void sb_ring_thread(void *, unsigned long);
+static void sb_seqlock_thread(void *, unsigned long);
+
+static
+void
+sem_uncontended(unsigned iters)
+{
+	unsigned i;
+
+	for (i = 0; i < iters; i++) {
+		P(sb_sem);
+		V(sb_sem);
+	}
+}
+
+static
+void
+sem_enter(bool write)
+{
+	(void)write;
+	P(sb_sem);
+}
+
+static
+void
+sem_leave(bool write)
+{
+	(void)write;
+	V(sb_sem);
+}
+
+static
+unsigned
+sem_waiters(void)
+{
+	return atomic_load(&sb_sem->sem_waiters);
+}
+
+static
+void
+lock_uncontended(unsigned iters)
+{
+	unsigned i;
+
+	for (i = 0; i < iters; i++) {
+		lock_acquire(sb_lock);
+		lock_release(sb_lock);
+	}
+}
+
+static
+void
+lock_enter(bool write)
+{
+	(void)write;
+	lock_acquire(sb_lock);
+}
+
+static
+void
+lock_leave(bool write)
+{
+	(void)write;
+	lock_release(sb_lock);
+}
+
+static
+unsigned
+lock_waiters(void)
+{
+	return atomic_load(&sb_lock->lock_waiters);
+}
+
+static
+void
+cv_uncontended(unsigned iters)
+{
+	unsigned i;
+
+	lock_acquire(sb_lock);
+	for (i = 0; i < iters; i++) {
+		cv_signal(sb_cv, sb_lock);
+	}
+	lock_release(sb_lock);
+}
+
+/*
+ * For the cv, entering means waiting for the handoff flag (sb_turn)
+ * and leaving means setting it and signalling.
+ */
+static
+void
+cv_enter(bool write)
+{
+	(void)write;
+	lock_acquire(sb_lock);
+	while (sb_turn == 0) {
+		cv_wait(sb_cv, sb_lock);
+	}
+	sb_turn = 0;
+	lock_release(sb_lock);
+}
+
+static
+void
+cv_leave(bool write)
+{
+	(void)write;
+	lock_acquire(sb_lock);
+	sb_turn = 1;
+	gettime(&sb_stamp);
+	cv_signal(sb_cv, sb_lock);
+	lock_release(sb_lock);
+}
+
+static
+unsigned
+cv_waiters(void)
+{
+	return atomic_load(&sb_cv->cv_waiters);
+}
+
+static
+void
+rwlock_uncontended(unsigned iters)
+{
+	unsigned i;
+
+	for (i = 0; i < iters; i++) {
+		rwlock_acquire_read(sb_rw);
+		rwlock_release_read(sb_rw);
+	}
+	for (i = 0; i < iters; i++) {
+		rwlock_acquire_write(sb_rw);
+		rwlock_release_write(sb_rw);
+	}
+}
+
+static
+void
+rwlock_enter(bool write)
+{
+	if (write) {
+		rwlock_acquire_write(sb_rw);
+	}
+	else {
+		rwlock_acquire_read(sb_rw);
+	}
+}
+
+static
+void
+rwlock_leave(bool write)
+{
+	if (write) {
+		rwlock_release_write(sb_rw);
+	}
+	else {
+		rwlock_release_read(sb_rw);
+	}
+}
+
+static
+unsigned
+rwlock_waiters(void)
+{
+	return atomic_load(&sb_rw->rw_readers_waiting);
+}
+
+/*
+ * One seqlock read: copy the data, and check the copy, which a reader
+ * may only do once seqlock_read_retry has said it is good.
+ */
+static
+void
+seqlock_read(void)
+{
+	unsigned seq, a, b;
+
+	do {
+		seq = seqlock_read_begin(sb_sl);
+		a = atomic_load(&sb_seqdata[0]);
+		sb_spin(sb_config.sc_cslen);
+		b = atomic_load(&sb_seqdata[1]);
+	} while (seqlock_read_retry(sb_sl, seq));
+	KASSERT(a == b);
+	(void)a;
+	(void)b;
+}
+
+static
+void
+seqlock_write(void)
+{
+	seqlock_write_begin(sb_sl);
+	atomic_store(&sb_seqdata[0], sb_seqdata[0] + 1);
+	sb_spin(sb_config.sc_cslen);
+	atomic_store(&sb_seqdata[1], sb_seqdata[1] + 1);
+	seqlock_write_end(sb_sl);
+}
+
+static
+void
+seqlock_uncontended(unsigned iters)
+{
+	unsigned i;
+
+	for (i = 0; i < iters; i++) {
+		seqlock_read();
+	}
+	for (i = 0; i < iters; i++) {
+		seqlock_write();
+	}
+}
+
+static
+void
+cohort_uncontended(unsigned iters)
+{
+	unsigned i;
+
+	for (i = 0; i < iters; i++) {
+		cohortlock_acquire(sb_ck);
+		cohortlock_release(sb_ck);
+	}
+}
+
+static
+void
+cohort_enter(bool write)
+{
+	(void)write;
+	cohortlock_acquire(sb_ck);
+}
+
+static
+void
+cohort_leave(bool write)
+{
+	(void)write;
+	cohortlock_release(sb_ck);
+}
+
+static
+unsigned
+cohort_waiters(void)
+{
+	unsigned i, n = 0;
+
+	for (i = 0; i < SYNCH_MAXCLUSTERS; i++) {
+		n += atomic_load(&sb_ck->ck_clusters[i].cc_waiters);
+	}
+	return n + atomic_load(&sb_ck->ck_waiters);
+}
+
+static
+void
+shardsem_uncontended(unsigned iters)
+{
+	unsigned i;
+
+	for (i = 0; i < iters; i++) {
+		shardsem_P(sb_shs);
+		shardsem_V(sb_shs);
+	}
+}
+
+static
+void
+shardsem_enter(bool write)
+{
+	(void)write;
+	shardsem_P(sb_shs);
+}
+
+static
+void
+shardsem_leave(bool write)
+{
+	(void)write;
+	shardsem_V(sb_shs);
+}
+
+static
+unsigned
+shardsem_waiters(void)
+{
+	return atomic_load(&sb_shs->shs_waiters);
+}
+
+static const struct sbprim sb_prims[] = {
+	{ "sem", sem_uncontended, sb_contended_thread,
+	  sem_enter, sem_leave, sem_waiters, false, 1 },
+	{ "lock", lock_uncontended, sb_contended_thread,
+	  lock_enter, lock_leave, lock_waiters, true, 1 },
+	{ "cv", cv_uncontended, sb_ring_thread,
+	  cv_enter, cv_leave, cv_waiters, false, 1 },
+	{ "rwlock", rwlock_uncontended, sb_contended_thread,
+	  rwlock_enter, rwlock_leave, rwlock_waiters, true, 2 },
+	{ "seqlock", seqlock_uncontended, sb_seqlock_thread,
+	  NULL, NULL, NULL, false, 2 },
+	{ "cohort", cohort_uncontended, sb_contended_thread,
+	  cohort_enter, cohort_leave, cohort_waiters, true, 1 },
+	{ "shardsem", shardsem_uncontended, sb_contended_thread,
+	  shardsem_enter, shardsem_leave, shardsem_waiters, false, 1 },
+};
+
+#define SB_NPRIMS (sizeof(sb_prims) / sizeof(sb_prims[0]))
+
+////////////////////////////////////////////////////////////
+// tests
+
+static
+void
+sb_uncontended(const struct sbprim *sp)
+{
+	struct timespec start, end;
+	unsigned iters = sb_config.sc_iters;
+
+	gettime(&start);
+	sp->sp_uncontended(iters);
+	gettime(&end);
+
+	sb_row(sp->sp_name, "uncontended", 1,
+	       (uint64_t)iters * sp->sp_uncontended_ops, sb_ns(&start, &end));
+}
+
+static
+void
+sb_contended_thread(void *data1, unsigned long me)
+{
+	const struct sbprim *sp = data1;
+	unsigned i, seed = me + 1;
+	bool write;
+
+	barrier_wait(sb_start);
+	gettime(&sb_starts[me]);
+	for (i = 0; i < sb_config.sc_iters; i++) {
+		write = sb_random(&seed) % 100 >= sb_config.sc_readpct;
+		sp->sp_enter(write);
+		sb_spin(sb_config.sc_cslen);
+		sp->sp_leave(write);
+	}
+	gettime(&sb_ends[me]);
+	waitgroup_done(sb_done);
+}
+
+/*
+ * The seqlock doesn't fit enter/leave: a read is a loop that goes
+ * around again whenever a write overlaps it.
+ */
+static
+void
+sb_seqlock_thread(void *data1, unsigned long me)
+{
+	unsigned i, seed = me + 1;
+
+	(void)data1;
+
+	barrier_wait(sb_start);
+	gettime(&sb_starts[me]);
+	for (i = 0; i < sb_config.sc_iters; i++) {
+		if (sb_random(&seed) % 100 >= sb_config.sc_readpct) {
+			seqlock_write();
+		}
+		else {
+			seqlock_read();
+		}
+	}
+	gettime(&sb_ends[me]);
+	waitgroup_done(sb_done);
+}
+
+/*
+ * Turns per thread in the cv ring. Every turn wakes the whole ring, so
+ * the total rather than the per-thread count is held to ITERS.
+ */
+static
+unsigned
+sb_ring_turns(unsigned nthreads)
+{
+	unsigned turns = sb_config.sc_iters / nthreads;
+
+	return turns > 0 ? turns : 1;
+}
+
+/*
+ * Pass a token around a ring of threads; each waits on the cv until
+ * it's its turn.
+ */
+static
+void
+sb_ring_thread(void *data1, unsigned long me)
+{
+	unsigned i, turns = sb_ring_turns(sb_nthreads);
+
+	(void)data1;
+
+	barrier_wait(sb_start);
+	gettime(&sb_starts[me]);
+	lock_acquire(sb_lock);
+	for (i = 0; i < turns; i++) {
+		while (sb_turn % sb_nthreads != me) {
+			cv_wait(sb_cv, sb_lock);
+		}
+		sb_spin(sb_config.sc_cslen);
+		sb_turn++;
+		cv_broadcast(sb_cv, sb_lock);
+	}
+	lock_release(sb_lock);
+	gettime(&sb_ends[me]);
+	waitgroup_done(sb_done);
+}
+
+static
+void
+sb_contended(const struct sbprim *sp, unsigned nthreads)
+{
+	struct timespec diff;
+	unsigned i, first, last, perthread;
+	int result;
+
+	sb_start = barrier_create("sb start", nthreads + 1);
+	if (sb_start == NULL) {
+		panic("synchbench: barrier_create failed\n");
+	}
+	sb_nthreads = nthreads;
+	sb_turn = 0;
+	waitgroup_add(sb_done, nthreads);
+
+	for (i = 0; i < nthreads; i++) {
+		result = thread_fork("synchbench", NULL, sp->sp_contended,
+				     (void *)sp, i);
+		if (result) {
+			panic("synchbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	barrier_wait(sb_start);
+	waitgroup_wait(sb_done);
+
+	first = last = 0;
+	for (i = 1; i < nthreads; i++) {
+		timespec_sub(&sb_starts[i], &sb_starts[first], &diff);
+		if (diff.tv_sec < 0) {
+			first = i;
+		}
+		timespec_sub(&sb_ends[i], &sb_ends[last], &diff);
+		if (diff.tv_sec >= 0) {
+			last = i;
+		}
+	}
+
+	barrier_destroy(sb_start);
+	sb_start = NULL;
+
+	perthread = sp->sp_contended == sb_ring_thread ?
+		sb_ring_turns(nthreads) : sb_config.sc_iters;
+	sb_row(sp->sp_name, "contended", nthreads,
+	       (uint64_t)nthreads * perthread,
+	       sb_ns(&sb_starts[first], &sb_ends[last]));
+}
+
+/*
+ * The waiting side of the handoff test: block in enter, and as soon as
+ * we're through, see how long ago the giving side let go.
+ */
+static
+void
+sb_handoff_thread(void *data1, unsigned long unused)
+{
+	const struct sbprim *sp = data1;
+	struct timespec now;
+	unsigned i;
+
+	(void)unused;
+
+	for (i = 0; i < SB_HANDOFFS; i++) {
+		/* Wait for the main thread to be holding it. */
+		while (sb_round == 2 * i) {
+			thread_yield();
+		}
+		sp->sp_enter(false);
+		gettime(&now);
+		sb_handoff_ns += sb_ns(&sb_stamp, &now);
+		if (sp->sp_owned) {
+			sp->sp_leave(false);
+		}
+		sb_round = 2 * i + 2;
+	}
+	waitgroup_done(sb_done);
+}
+
+static
+void
+sb_handoff(const struct sbprim *sp)
+{
+	unsigned i;
+	int result;
+
+	sb_round = 0;
+	sb_turn = 0;
+	sb_handoff_ns = 0;
+	waitgroup_add(sb_done, 1);
+	result = thread_fork("synchbench", NULL, sb_handoff_thread,
+			     (void *)sp, 0);
+	if (result) {
+		panic("synchbench: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+
+	/*
+	 * Hold the object (a semaphore's count is 0 and the cv flag is
+	 * clear to begin with), let the other thread go to sleep on it,
+	 * then stamp the time and give it up. The cv stamps under its
+	 * lock, just before the signal.
+	 */
+	for (i = 0; i < SB_HANDOFFS; i++) {
+		if (sp->sp_owned) {
+			sp->sp_enter(true);
+		}
+		sb_round = 2 * i + 1;
+		while (sp->sp_waiters() == 0) {
+			thread_yield();
+		}
+		if (sp->sp_enter != cv_enter) {
+			gettime(&sb_stamp);
+		}
+		sp->sp_leave(true);
+		while (sb_round != 2 * i + 2) {
+			thread_yield();
+		}
+	}
+	waitgroup_wait(sb_done);
+
+	sb_row(sp->sp_name, "handoff", 2, SB_HANDOFFS, sb_handoff_ns);
+}
+
+static
+void
+sb_run(const struct sbprim *sp)
+{
+	unsigned n;
+
+	sb_uncontended(sp);
+	for (n = 1; n < sb_config.sc_maxthreads; n *= 2) {
+		sb_contended(sp, n);
+	}
+	sb_contended(sp, sb_config.sc_maxthreads);
+
+	/* The semaphores start at 0 for this one. */
+	if (sp->sp_waiters == NULL) {
+		/* nothing to hand off */
+	}
+	else if (sp->sp_enter == sem_enter) {
+		P(sb_sem);
+		sb_handoff(sp);
+		V(sb_sem);
+	}
+	else if (sp->sp_enter == shardsem_enter) {
+		for (n = 0; n < SB_MAXTHREADS; n++) {
+			shardsem_P(sb_shs);
+		}
+		sb_handoff(sp);
+		for (n = 0; n < SB_MAXTHREADS; n++) {
+			shardsem_V(sb_shs);
+		}
+	}
+	else {
+		sb_handoff(sp);
+	}
+}
+
+int
+synchbench(int nargs, char **args)
+{
+	const char *which = nargs > 1 ? args[1] : "all";
+	bool found = false, instr, wake;
+	unsigned i;
+
+	sb_config.sc_maxthreads = nargs > 2 ? atoi(args[2]) : SB_THREADS;
+	sb_config.sc_iters = nargs > 3 ? atoi(args[3]) : SB_ITERS;
+	sb_config.sc_cslen = nargs > 4 ? atoi(args[4]) : SB_CSLEN;
+	sb_config.sc_readpct = nargs > 5 ? atoi(args[5]) : SB_READPCT;
+	sb_config.sc_instr = nargs > 6 ? atoi(args[6]) : -1;
+	sb_config.sc_wake = nargs > 7 ? atoi(args[7]) : -1;
+
+	if (sb_config.sc_maxthreads < 1 ||
+	    sb_config.sc_maxthreads > SB_MAXTHREADS ||
+	    sb_config.sc_readpct > 100 ||
+	    sb_config.sc_instr < -1 || sb_config.sc_instr > 1 ||
+	    sb_config.sc_wake < -1 || sb_config.sc_wake > 1) {
+		kprintf("Usage: sb [sem|lock|cv|rwlock|seqlock|cohort|"
+			"shardsem|all [maxthreads [iters [cslen [readpct "
+			"[instr [wake]]]]]]]\n"
+			"    maxthreads at most %u, readpct at most 100, "
+			"instr and wake 0 or 1\n", SB_MAXTHREADS);
+		return EINVAL;
+	}
+
+	instr = synch_instrument_get();
+	if (sb_config.sc_instr >= 0) {
+		synch_instrument_set(sb_config.sc_instr);
+	}
+	wake = synch_wakeaffine_get();
+	if (sb_config.sc_wake >= 0) {
+		synch_wakeaffine_set(sb_config.sc_wake);
+	}
+
+	sb_sem = sem_create("sb sem", 1);
+	sb_lock = lock_create("sb lock");
+	sb_cv = cv_create("sb cv");
+	sb_rw = rwlock_create("sb rwlock");
+	sb_sl = seqlock_create("sb seqlock");
+	sb_ck = cohortlock_create("sb cohort");
+	sb_shs = shardsem_create("sb shardsem", SB_MAXTHREADS);
+	sb_done = waitgroup_create("sb done");
+	if (sb_sem == NULL || sb_lock == NULL || sb_cv == NULL ||
+	    sb_rw == NULL || sb_sl == NULL || sb_ck == NULL || sb_shs == NULL ||
+	    sb_done == NULL) {
+		panic("synchbench: out of memory\n");
+	}
+
+	sb_header();
+	for (i = 0; i < SB_NPRIMS; i++) {
+		if (!strcmp(which, "all") || !strcmp(which, sb_prims[i].sp_name)) {
+			sb_run(&sb_prims[i]);
+			found = true;
+		}
+	}
+
+	synch_instrument_set(instr);
+	synch_wakeaffine_set(wake);
+
+	waitgroup_destroy(sb_done);
+	shardsem_destroy(sb_shs);
+	cohortlock_destroy(sb_ck);
+	seqlock_destroy(sb_sl);
+	rwlock_destroy(sb_rw);
+	cv_destroy(sb_cv);
+	lock_destroy(sb_lock);
+	sem_destroy(sb_sem);
+
+	if (!found) {
+		kprintf("sb: unknown primitive %s\n", which);
+		return EINVAL;
+	}
+	return 0;
+}
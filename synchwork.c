@@ -0,0 +1,627 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Workload benchmarks: the classic concurrency problems, built on the
+ * primitives the way real code uses them.
+ *
+ *    bb    - bounded buffer; half the threads produce and half consume,
+ *            with a lock and two cvs. One operation is a put or a get.
+ *    phil  - dining philosophers, one lock per fork, taken in order.
+ *            One operation is a meal; its latency is the wait for the
+ *            forks.
+ *    rw    - readers and writers on an rwlock-protected table, at 50%,
+ *            90% and 99% reads.
+ *    pool  - a thread pool: one thread submits jobs into a bounded
+ *            queue (lock, cv and a semaphore for free slots), the rest
+ *            run them. Latency is from submission to completion.
+ *
+ * Each workload runs for a fixed time. Per operation latencies go into
+ * log2 histograms, one per thread, merged at the end. Output is CSV:
+ * throughput, latency percentiles (the upper bound of the histogram
+ * bucket they fall into), and Jain's fairness index over the number of
+ * operations each thread got done, times 1000 (1000 is perfectly fair,
+ * 1000/N is one thread doing everything).
+ *
+ * Usage (kernel menu or host build):
+ *
+ *    sw [workload [threads [seconds]]]
+ *
+ * WORKLOAD is bb, phil, rw, pool or all.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+
+#define SW_MAXTHREADS	24
+#define SW_NBUCKETS	40	/* log2 latency buckets, up to ~1000s */
+
+#define SW_BUFSIZE	16	/* bounded buffer slots */
+#define SW_TABLESIZE	64	/* rw table entries */
+#define SW_QUEUESIZE	32	/* thread pool queue slots */
+#define SW_THINK	200	/* busy loop outside critical sections */
+#define SW_WORK		100	/* busy loop inside them */
+
+/* Defaults for the arguments. */
+#define SW_THREADS	8
+#define SW_SECONDS	2
+
+/*
+ * What one thread got done.
+ */
+struct swstat {
+	uint64_t ss_ops;
+	uint64_t ss_max;
+	unsigned ss_hist[SW_NBUCKETS];
+};
+
+static struct swstat sw_stats[SW_MAXTHREADS];
+static unsigned sw_nthreads;
+static volatile bool sw_stop;
+static struct waitgroup *sw_done;
+
+/* bb */
+static struct lock *bb_lock;
+static struct cv *bb_notfull, *bb_notempty;
+static unsigned bb_buf[SW_BUFSIZE];
+static unsigned bb_count, bb_in, bb_out;
+
+/* phil */
+static struct lock *phil_forks[SW_MAXTHREADS];
+
+/* rw */
+static struct rwlock *rw_lock;
+static unsigned rw_table[SW_TABLESIZE];
+static unsigned rw_readpct;
+
+/* pool */
+struct swjob {
+	struct timespec j_submitted;
+	unsigned j_work;
+};
+
+static struct lock *pool_lock;
+static struct cv *pool_cv;
+static struct semaphore *pool_slots;
+static struct swjob pool_queue[SW_QUEUESIZE];
+static unsigned pool_count, pool_in, pool_out;
+
+////////////////////////////////////////////////////////////
+// utilities
+
+static
+uint64_t
+sw_ns(const struct timespec *start, const struct timespec *end)
+{
+	struct timespec diff;
+
+	timespec_sub(end, start, &diff);
+	return (uint64_t)diff.tv_sec * 1000000000 + diff.tv_nsec;
+}
+
+static
+void
+sw_spin(unsigned n)
+{
+	volatile unsigned i;
+
+	for (i = 0; i < n; i++) {
+		/* nothing */
+	}
+}
+
+static
+unsigned
+sw_random(unsigned *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+/*
+ * Count one operation that took from START to now.
+ */
+static
+void
+sw_record(unsigned me, const struct timespec *start)
+{
+	struct swstat *ss = &sw_stats[me];
+	struct timespec now;
+	uint64_t ns;
+	unsigned b;
+
+	gettime(&now);
+	ns = sw_ns(start, &now);
+	for (b = 0; b < SW_NBUCKETS - 1 && (ns >> b) > 1; b++) {
+		/* nothing */
+	}
+	ss->ss_hist[b]++;
+	ss->ss_ops++;
+	if (ns > ss->ss_max) {
+		ss->ss_max = ns;
+	}
+}
+
+/*
+ * The latency below which PERMILLE thousandths of the operations fall,
+ * rounded up to a bucket boundary.
+ */
+static
+uint64_t
+sw_percentile(const unsigned *hist, uint64_t total, unsigned permille)
+{
+	uint64_t want, seen;
+	unsigned b;
+
+	want = (total * permille + 999) / 1000;
+	seen = 0;
+	for (b = 0; b < SW_NBUCKETS; b++) {
+		seen += hist[b];
+		if (seen >= want) {
+			break;
+		}
+	}
+	return (uint64_t)2 << b;
+}
+
+static
+void
+sw_header(void)
+{
+	kprintf("workload,threads,readpct,ns,ops,ops_per_sec,"
+		"p50_ns,p99_ns,p999_ns,max_ns,fairness\n");
+}
+
+/*
+ * Merge the per-thread stats of the first NSTATS threads and print the
+ * row.
+ */
+static
+void
+sw_report(const char *name, unsigned nstats, unsigned readpct, uint64_t ns)
+{
+	unsigned hist[SW_NBUCKETS];
+	uint64_t ops, max, sumsq, fairness;
+	unsigned i, b;
+
+	bzero(hist, sizeof(hist));
+	ops = max = sumsq = 0;
+	for (i = 0; i < nstats; i++) {
+		for (b = 0; b < SW_NBUCKETS; b++) {
+			hist[b] += sw_stats[i].ss_hist[b];
+		}
+		ops += sw_stats[i].ss_ops;
+		sumsq += sw_stats[i].ss_ops * sw_stats[i].ss_ops;
+		if (sw_stats[i].ss_max > max) {
+			max = sw_stats[i].ss_max;
+		}
+	}
+
+	/* Jain: (sum x)^2 / (n * sum x^2). */
+	fairness = sumsq == 0 ? 0 : (ops * ops / nstats) * 1000 / sumsq;
+
+	kprintf("%s,%u,%u,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+		name, sw_nthreads, readpct,
+		(unsigned long long)ns, (unsigned long long)ops,
+		(unsigned long long)(ops * 1000000000 / (ns ? ns : 1)),
+		(unsigned long long)sw_percentile(hist, ops, 500),
+		(unsigned long long)sw_percentile(hist, ops, 990),
+		(unsigned long long)sw_percentile(hist, ops, 999),
+		(unsigned long long)max,
+		(unsigned long long)fairness);
+}
+
+/*
+ * Start NTHREADS copies of FUNC, let them go for SECONDS, and stop
+ * them. WAKE, if not NULL, is called after setting sw_stop to get any
+ * sleeping threads moving. Returns how long the run took.
+ */
+static
+uint64_t
+sw_run(unsigned nthreads, unsigned seconds,
+       void (*func)(void *, unsigned long), void (*wake)(void))
+{
+	struct timespec start, end;
+	unsigned i;
+	int result;
+
+	bzero(sw_stats, sizeof(sw_stats));
+	sw_stop = false;
+	waitgroup_add(sw_done, nthreads);
+
+	gettime(&start);
+	for (i = 0; i < nthreads; i++) {
+		result = thread_fork("synchwork", NULL, func, NULL, i);
+		if (result) {
+			panic("synchwork: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	clocksleep(seconds);
+	sw_stop = true;
+	if (wake != NULL) {
+		wake();
+	}
+	waitgroup_wait(sw_done);
+	gettime(&end);
+
+	return sw_ns(&start, &end);
+}
+
+////////////////////////////////////////////////////////////
+// bounded buffer
+
+static
+void
+bb_thread(void *unused, unsigned long me)
+{
+	struct timespec start;
+	bool producer = (me % 2 == 0);
+	unsigned item = 0;
+
+	(void)unused;
+
+	while (!sw_stop) {
+		sw_spin(SW_THINK);
+		gettime(&start);
+		lock_acquire(bb_lock);
+		if (producer) {
+			while (bb_count == SW_BUFSIZE && !sw_stop) {
+				cv_wait(bb_notfull, bb_lock);
+			}
+			if (bb_count < SW_BUFSIZE) {
+				bb_buf[bb_in] = item++;
+				bb_in = (bb_in + 1) % SW_BUFSIZE;
+				bb_count++;
+				cv_signal(bb_notempty, bb_lock);
+			}
+		}
+		else {
+			while (bb_count == 0 && !sw_stop) {
+				cv_wait(bb_notempty, bb_lock);
+			}
+			if (bb_count > 0) {
+				item = bb_buf[bb_out];
+				bb_out = (bb_out + 1) % SW_BUFSIZE;
+				bb_count--;
+				cv_signal(bb_notfull, bb_lock);
+			}
+		}
+		lock_release(bb_lock);
+		sw_record(me, &start);
+	}
+	waitgroup_done(sw_done);
+}
+
+static
+void
+bb_wake(void)
+{
+	lock_acquire(bb_lock);
+	cv_broadcast(bb_notfull, bb_lock);
+	cv_broadcast(bb_notempty, bb_lock);
+	lock_release(bb_lock);
+}
+
+static
+void
+sw_bb(unsigned nthreads, unsigned seconds)
+{
+	uint64_t ns;
+
+	/* At least one of each. */
+	if (nthreads < 2) {
+		nthreads = 2;
+	}
+	sw_nthreads = nthreads;
+
+	bb_lock = lock_create("bb");
+	bb_notfull = cv_create("bb notfull");
+	bb_notempty = cv_create("bb notempty");
+	if (bb_lock == NULL || bb_notfull == NULL || bb_notempty == NULL) {
+		panic("synchwork: out of memory\n");
+	}
+	bb_count = bb_in = bb_out = 0;
+
+	ns = sw_run(nthreads, seconds, bb_thread, bb_wake);
+	sw_report("bb", nthreads, 0, ns);
+
+	cv_destroy(bb_notempty);
+	cv_destroy(bb_notfull);
+	lock_destroy(bb_lock);
+}
+
+////////////////////////////////////////////////////////////
+// dining philosophers
+
+static
+void
+phil_thread(void *unused, unsigned long me)
+{
+	struct timespec start;
+	unsigned left = me, right = (me + 1) % sw_nthreads;
+	unsigned first, second;
+
+	(void)unused;
+
+	/* Lower-numbered fork first, so there's no cycle. */
+	first = left < right ? left : right;
+	second = left < right ? right : left;
+
+	while (!sw_stop) {
+		sw_spin(SW_THINK);
+		gettime(&start);
+		lock_acquire(phil_forks[first]);
+		lock_acquire(phil_forks[second]);
+		sw_record(me, &start);
+		sw_spin(SW_WORK);
+		lock_release(phil_forks[second]);
+		lock_release(phil_forks[first]);
+	}
+	waitgroup_done(sw_done);
+}
+
+static
+void
+sw_phil(unsigned nthreads, unsigned seconds)
+{
+	uint64_t ns;
+	unsigned i;
+
+	/* One philosopher would have only one fork. */
+	if (nthreads < 2) {
+		nthreads = 2;
+	}
+	sw_nthreads = nthreads;
+
+	for (i = 0; i < nthreads; i++) {
+		phil_forks[i] = lock_create("fork");
+		if (phil_forks[i] == NULL) {
+			panic("synchwork: out of memory\n");
+		}
+	}
+
+	ns = sw_run(nthreads, seconds, phil_thread, NULL);
+	sw_report("phil", nthreads, 0, ns);
+
+	for (i = 0; i < nthreads; i++) {
+		lock_destroy(phil_forks[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////
+// readers and writers
+
+static
+void
+rw_thread(void *unused, unsigned long me)
+{
+	struct timespec start;
+	unsigned seed = me + 1, i, sum;
+
+	(void)unused;
+
+	while (!sw_stop) {
+		sw_spin(SW_THINK);
+		gettime(&start);
+		if (sw_random(&seed) % 100 < rw_readpct) {
+			rwlock_acquire_read(rw_lock);
+			sum = 0;
+			for (i = 0; i < SW_TABLESIZE; i++) {
+				sum += rw_table[i];
+			}
+			KASSERT(sum % SW_TABLESIZE == 0);
+			rwlock_release_read(rw_lock);
+		}
+		else {
+			rwlock_acquire_write(rw_lock);
+			for (i = 0; i < SW_TABLESIZE; i++) {
+				rw_table[i]++;
+			}
+			rwlock_release_write(rw_lock);
+		}
+		sw_record(me, &start);
+	}
+	waitgroup_done(sw_done);
+}
+
+static
+void
+sw_rw(unsigned nthreads, unsigned seconds)
+{
+	static const unsigned readpcts[] = { 50, 90, 99 };
+	uint64_t ns;
+	unsigned i;
+
+	sw_nthreads = nthreads;
+	rw_lock = rwlock_create("rw");
+	if (rw_lock == NULL) {
+		panic("synchwork: out of memory\n");
+	}
+	bzero(rw_table, sizeof(rw_table));
+
+	for (i = 0; i < sizeof(readpcts) / sizeof(readpcts[0]); i++) {
+		rw_readpct = readpcts[i];
+		ns = sw_run(nthreads, seconds, rw_thread, NULL);
+		sw_report("rw", nthreads, rw_readpct, ns);
+	}
+
+	rwlock_destroy(rw_lock);
+}
+
+////////////////////////////////////////////////////////////
+// thread pool
+
+/*
+ * Thread 0 submits; the rest are the pool. Only the pool's stats are
+ * reported.
+ */
+static
+void
+pool_thread(void *unused, unsigned long me)
+{
+	struct swjob job;
+	unsigned seed = 1;
+
+	(void)unused;
+
+	if (me == 0) {
+		while (!sw_stop) {
+			P(pool_slots);
+			lock_acquire(pool_lock);
+			gettime(&pool_queue[pool_in].j_submitted);
+			pool_queue[pool_in].j_work = SW_WORK +
+				sw_random(&seed) % SW_WORK;
+			pool_in = (pool_in + 1) % SW_QUEUESIZE;
+			pool_count++;
+			cv_signal(pool_cv, pool_lock);
+			lock_release(pool_lock);
+		}
+		waitgroup_done(sw_done);
+		return;
+	}
+
+	while (1) {
+		lock_acquire(pool_lock);
+		while (pool_count == 0 && !sw_stop) {
+			cv_wait(pool_cv, pool_lock);
+		}
+		if (pool_count == 0) {
+			lock_release(pool_lock);
+			break;
+		}
+		job = pool_queue[pool_out];
+		pool_out = (pool_out + 1) % SW_QUEUESIZE;
+		pool_count--;
+		lock_release(pool_lock);
+		V(pool_slots);
+
+		sw_spin(job.j_work);
+		sw_record(me - 1, &job.j_submitted);
+	}
+	waitgroup_done(sw_done);
+}
+
+static
+void
+pool_wake(void)
+{
+	/* Let the submitter out if it's waiting for a slot. */
+	V(pool_slots);
+	lock_acquire(pool_lock);
+	cv_broadcast(pool_cv, pool_lock);
+	lock_release(pool_lock);
+}
+
+static
+void
+sw_pool(unsigned nthreads, unsigned seconds)
+{
+	uint64_t ns;
+
+	/* The submitter and at least one worker. */
+	if (nthreads < 2) {
+		nthreads = 2;
+	}
+	sw_nthreads = nthreads - 1;
+
+	pool_lock = lock_create("pool");
+	pool_cv = cv_create("pool");
+	pool_slots = sem_create("pool slots", SW_QUEUESIZE);
+	if (pool_lock == NULL || pool_cv == NULL || pool_slots == NULL) {
+		panic("synchwork: out of memory\n");
+	}
+	pool_count = pool_in = pool_out = 0;
+
+	ns = sw_run(nthreads, seconds, pool_thread, pool_wake);
+	sw_report("pool", nthreads - 1, 0, ns);
+
+	sem_destroy(pool_slots);
+	cv_destroy(pool_cv);
+	lock_destroy(pool_lock);
+}
+
+////////////////////////////////////////////////////////////
+
+static const struct {
+	const char *name;
+	void (*func)(unsigned nthreads, unsigned seconds);
+} sw_workloads[] = {
+	{ "bb", sw_bb },
+	{ "phil", sw_phil },
+	{ "rw", sw_rw },
+	{ "pool", sw_pool },
+};
+
+#define SW_NWORKLOADS (sizeof(sw_workloads) / sizeof(sw_workloads[0]))
+
+int
+synchwork(int nargs, char **args)
+{
+	const char *which = nargs > 1 ? args[1] : "all";
+	unsigned nthreads, seconds, i;
+	bool found = false;
+
+	nthreads = nargs > 2 ? atoi(args[2]) : SW_THREADS;
+	seconds = nargs > 3 ? atoi(args[3]) : SW_SECONDS;
+	if (nthreads < 1 || nthreads > SW_MAXTHREADS || seconds < 1) {
+		kprintf("Usage: sw [bb|phil|rw|pool|all [threads "
+			"[seconds]]]\n"
+			"    threads at most %u\n", SW_MAXTHREADS);
+		return EINVAL;
+	}
+
+	sw_done = waitgroup_create("sw done");
+	if (sw_done == NULL) {
+		panic("synchwork: out of memory\n");
+	}
+
+	sw_header();
+	for (i = 0; i < SW_NWORKLOADS; i++) {
+		if (!strcmp(which, "all") ||
+		    !strcmp(which, sw_workloads[i].name)) {
+			sw_workloads[i].func(nthreads, seconds);
+			found = true;
+		}
+	}
+
+	waitgroup_destroy(sw_done);
+
+	if (!found) {
+		kprintf("sw: unknown workload %s\n", which);
+		return EINVAL;
+	}
+	return 0;
+}